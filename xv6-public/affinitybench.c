@@ -0,0 +1,85 @@
+/**
+ * This program compares memory-bound workers pinned to one cpu each with
+ * the same workers left free to migrate. Every worker keeps sweeping its
+ * own buffer, which fits in the private caches of a core, so every
+ * migration costs it a cold cache. The sweeps done in DURATION ticks are
+ * reported for both runs. Run it with CPUS=2 or more.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define BUFSIZE (32 * 1024)
+#define LINE 64
+#define DURATION 300
+
+static void
+worker(int mask, int start, int pipe)
+{
+  char *buf = malloc(BUFSIZE);
+  int i, sweeps = 0;
+
+  if(buf == 0 || (mask && sched_setaffinity(0, mask) < 0)) {
+    printf(1, "worker setup failed\n");
+    write(pipe, &sweeps, sizeof sweeps);
+    return;
+  }
+  memset(buf, 0, BUFSIZE);
+
+  while(uptime() < start)
+    ;
+  while(uptime() - start < DURATION) {
+    for(i = 0; i < BUFSIZE; i += LINE)
+      buf[i]++;
+    sweeps++;
+  }
+  write(pipe, &sweeps, sizeof sweeps);
+}
+
+// Run one worker per cpu and return the total number of sweeps
+static int
+run(int ncpu, int pinned)
+{
+  int fds[2], i, sweeps, total = 0, start;
+
+  if(pipe(fds) < 0)
+    return -1;
+  start = uptime() + 10;
+  for(i = 0; i < ncpu; i++) {
+    int pid = fork();
+    if(pid < 0)
+      return -1;
+    if(pid == 0) {
+      close(fds[0]);
+      worker(pinned ? 1 << i : 0, start, fds[1]);
+      exit();
+    }
+  }
+  for(i = 0; i < ncpu; i++) {
+    wait();
+    if(read(fds[0], &sweeps, sizeof sweeps) == sizeof sweeps)
+      total += sweeps;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat st;
+  int unpinned, pinned;
+
+  getkstat(&st);
+  unpinned = run(st.ncpu, 0);
+  pinned = run(st.ncpu, 1);
+
+  printf(1, "%d workers, %d ticks\n", st.ncpu, DURATION);
+  printf(1, "unpinned: %d sweeps\n", unpinned);
+  printf(1, "pinned  : %d sweeps (%d%% of unpinned)\n", pinned,
+         unpinned > 0 ? pinned * 100 / unpinned : 0);
+  exit();
+}
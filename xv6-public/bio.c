@@ -40,7 +40,7 @@ binit(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  initlock_kind(&bcache.lock, "bcache", SPIN_TICKET);
 
 //PAGEBREAK!
   // Create linked list of buffers
@@ -3,10 +3,13 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct kstat;
 struct pipe;
 struct proc;
 struct rtcdate;
 struct spinlock;
+struct seqlock;
 struct sleeplock;
 struct stat;
 struct superblock;
@@ -72,6 +75,14 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+uint            kalloc_count(void);
+char*           kzalloc(void);
+int             kzero_idle(void);
+char*           kalloc_pages(int);
+void            kfree_pages(char*, int);
+void            kalloc_stat(uint*);
+void            kdup(char*);
+int             krefcount(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -81,6 +92,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -100,6 +112,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -112,28 +125,47 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
-struct cpu*     mycpu(void);
-struct proc*    myproc();
+void            kick_idle_cpu(struct proc*);
+int             lwp_allowed(struct proc*, struct lwp*, struct cpu*);
+struct cpu*     lapiccpu(void);
 void            pinit(void);
 void            procdump(void);
+int             proc_allowed(struct proc*, struct cpu*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+int             stop_other_lwps(void);
+void            tlbshootdown(struct proc*);
+void            tlbflush(struct cpu*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeup_lwp(struct proc*, struct lwp*);
 void            yield(void);
 void            yield1(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// seqlock.c
+void            initseqlock(struct seqlock*, char*);
+void            write_seqlock(struct seqlock*);
+void            write_sequnlock(struct seqlock*);
+uint            read_seqbegin(struct seqlock*);
+int             read_seqretry(struct seqlock*, uint);
+
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlock_kind(struct spinlock*, char*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -156,6 +188,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptrw(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -164,17 +197,28 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// timerwheel.c
+void            timer_expire(uint);
+int             timer_sleep(uint);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
+uint            getticks(void);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// waitq.c
+extern uint     waitq_nvisit;
+void            waitq_insert(struct proc*, struct lwp*);
+void            waitq_remove(struct lwp*);
+void            waitq_wakeup(void*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -182,10 +226,15 @@ pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             unmapuvm(pde_t*, uint, uint);
+void            freeuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint, struct lwp**);
+int             cowfault(uint);
+int             cowbreak(uint, uint);
+int             cowsink(uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -200,6 +249,31 @@ int             getlev(void);
 // impl_set_cpu_share.c
 int             set_cpu_share(int share);
 
+// impl_getkstat.c
+int             getkstat(struct kstat*);
+
+// impl_set_sched_policy.c
+int             set_sched_policy(int policy);
+
+// impl_sched_affinity.c
+int             sched_setaffinity(int pid, uint mask);
+int             sched_getaffinity(int pid);
+int             thread_setaffinity(thread_t tid, uint mask);
+int             thread_getaffinity(thread_t tid);
+
+// impl_futex.c
+int             futex(int *addr, int op, int val);
+void            futex_enqueue(struct proc *p, pde_t *pgdir, uint uva);
+int             futex_sleep(struct proc *p);
+int             futex_wake(pde_t *pgdir, uint uva, int n);
+
+// impl_lockbench.c
+int             lockbench(int kind, int nticks);
+int             lockcycles(int kind, int n);
+
+// impl_buddytest.c
+int             buddytest(int rounds, uint seed);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
 
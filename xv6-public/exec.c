@@ -18,6 +18,7 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
+  struct lwp **curlwp;
 
   begin_op();
 
@@ -29,8 +30,6 @@ exec(char *path, char **argv)
   ilock(ip);
   pgdir = 0;
 
-  acquiresleep(&curproc->lock);
-
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
     goto bad;
@@ -89,6 +88,14 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  // The other lwps must neither run in the image being replaced nor
+  // exec themselves, so stop them once nothing can fail anymore. If
+  // another lwp is already stopping them, this one retires on its way
+  // back to user space instead.
+  if(stop_other_lwps() < 0)
+    goto bad;
+  acquiresleep(&curproc->lock);
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
@@ -96,10 +103,14 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Set the current lwp as the main lwp
-  struct lwp* temp = curproc->lwps[curproc->lwp_idx];
-  curproc->lwps[curproc->lwp_idx] = curproc->lwps[0];
+  curlwp = mylwp1(curproc);
+  struct lwp* temp = *curlwp;
+  *curlwp = curproc->lwps[0];
   curproc->lwps[0] = temp;
   curproc->lwp_idx = 0;
+  pushcli();
+  mycpu()->lwp = &curproc->lwps[0];
+  popcli();
 
   // Remove other lwps
   for(int i = 1;i < NLWPS; ++i){
@@ -120,6 +131,8 @@ exec(char *path, char **argv)
   mylwp(curproc)->tf->eip = elf.entry;  // main
   mylwp(curproc)->tf->esp = sp;
 
+  curproc->lwp_reaper = 0;
+
   switchuvm(curproc);
   freevm(oldpgdir);
   releasesleep(&curproc->lock);
@@ -132,6 +145,5 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
-  releasesleep(&curproc->lock);
   return -1;
 }
@@ -0,0 +1,139 @@
+/**
+ * This program stresses the page allocator from every cpu at once.
+ * One worker per cpu keeps forking a child which exits right away, so
+ * each round allocates and frees a page table, a kernel stack and a copy
+ * of the worker's memory. It reports the forks and the pages handed out
+ * by kalloc() per second over DURATION ticks. Run it with CPUS=4.
+ *
+ * Before that it reports the latency of one fork, exit and wait round
+ * while the rest of the system is idle, again after growing the heap by
+ * HEAPPAGES touched pages, and of the fork and exec round which the
+ * shell makes for every command of a pipeline, with the pages each one
+ * allocates. fork() shares memory copy-on-write, so the first two should
+ * be close and only pages the child writes to get copied.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+#include "x86.h"
+
+#define DURATION 300
+#define MAXWORKERS 8
+#define NLATENCY 200
+#define HEAPPAGES 256
+
+// Average TSC cycles of one fork, exit and wait round
+static uint
+fork_latency(void)
+{
+  unsigned long long start;
+  int i, pid;
+
+  start = rdtsc();
+  for(i = 0; i < NLATENCY; i++) {
+    if((pid = fork()) < 0)
+      return 0;
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  return (uint)(rdtsc() - start) / NLATENCY;
+}
+
+// Average TSC cycles and pages allocated of one fork, exec, exit and
+// wait round running echo with its output closed
+static uint
+exec_latency(uint *pages)
+{
+  struct kstat before, after;
+  unsigned long long start;
+  char *argv[] = {"echo", "x", 0};
+  int i, pid;
+
+  getkstat(&before);
+  start = rdtsc();
+  for(i = 0; i < NLATENCY; i++) {
+    if((pid = fork()) < 0)
+      return 0;
+    if(pid == 0) {
+      close(1);
+      exec("echo", argv);
+      exit();
+    }
+    wait();
+  }
+  getkstat(&after);
+  *pages = (after.kalloc_pages - before.kalloc_pages) / NLATENCY;
+  return (uint)(rdtsc() - start) / NLATENCY;
+}
+
+static void
+worker(int start, int pipe)
+{
+  int pid, forks = 0;
+
+  while(uptime() < start)
+    ;
+  while(uptime() - start < DURATION) {
+    if((pid = fork()) < 0)
+      break;
+    if(pid == 0)
+      exit();
+    wait();
+    forks++;
+  }
+  write(pipe, &forks, sizeof forks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  int fds[2], i, n, nworkers, forks, total = 0, start;
+  uint pages = 0;
+  char *heap;
+
+  printf(1, "fork latency %d cycles\n", fork_latency());
+  if((heap = sbrk(HEAPPAGES * 4096)) != (char*)-1) {
+    for(i = 0; i < HEAPPAGES; i++)
+      heap[i * 4096] = i;
+    printf(1, "fork latency %d cycles with %d more pages\n", fork_latency(),
+           HEAPPAGES);
+    sbrk(-HEAPPAGES * 4096);
+  }
+  n = exec_latency(&pages);
+  printf(1, "fork+exec latency %d cycles, %d pages\n", n, pages);
+
+  getkstat(&before);
+  nworkers = before.ncpu < MAXWORKERS ? before.ncpu : MAXWORKERS;
+  if(pipe(fds) < 0) {
+    printf(1, "pipe failure\n");
+    exit();
+  }
+
+  start = uptime() + 10;
+  for(i = 0; i < nworkers; i++) {
+    if((n = fork()) < 0) {
+      printf(1, "FAIL : fork\n");
+      exit();
+    }
+    if(n == 0) {
+      close(fds[0]);
+      worker(start, fds[1]);
+      exit();
+    }
+  }
+  for(i = 0; i < nworkers; i++) {
+    wait();
+    if(read(fds[0], &forks, sizeof forks) == sizeof forks)
+      total += forks;
+  }
+  getkstat(&after);
+
+  printf(1, "%d workers, %d ticks\n", nworkers, DURATION);
+  printf(1, "%d forks/sec, %d pages allocated/sec\n", total * 100 / DURATION,
+         (after.kalloc_pages - before.kalloc_pages) / DURATION * 100);
+  exit();
+}
@@ -0,0 +1,4 @@
+#pragma once
+// Operations of futex()
+#define FUTEX_WAIT 0 // Sleep while *addr == val
+#define FUTEX_WAKE 1 // Wake up at most val lwps sleeping on addr
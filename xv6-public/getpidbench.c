@@ -0,0 +1,34 @@
+/**
+ * This program measures the round trip of a trivial system call.
+ * getpid() does no work beyond trap entry, syscall dispatch, myproc()
+ * and trap return, so its cost is dominated by the per-cpu lookups on
+ * that path. It reports the average TSC cycles and the calls per second
+ * of NCALLS calls.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define NCALLS 200000
+
+int
+main(int argc, char *argv[])
+{
+  unsigned long long start;
+  uint cycles;
+  int i, ticks;
+
+  ticks = uptime();
+  start = rdtsc();
+  for(i = 0; i < NCALLS; i++)
+    getpid();
+  cycles = rdtsc() - start;
+  if((ticks = uptime() - ticks) == 0)
+    ticks = 1;
+
+  printf(1, "%d getpid() calls: %d cycles per call, %d calls/sec\n", NCALLS,
+         cycles / NCALLS, NCALLS / ticks * 100);
+  exit();
+}
@@ -0,0 +1,117 @@
+#include "types.h"
+#include "x86.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+
+#define BUDDYTEST_SLOTS 64
+#define BUDDYTEST_MAX_ROUNDS 1000000
+
+static uint
+nextrand(uint *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+// Free pages on the buddy lists
+static uint
+buddy_nfree(void)
+{
+  uint nfree[KMAXORDER + 1], n = 0;
+  int order;
+
+  kalloc_stat(nfree);
+  for(order = 0; order <= KMAXORDER; order++)
+    n += nfree[order] << order;
+  return n;
+}
+
+// Stamp the first word of every page of a block, and check it back.
+static void
+buddy_stamp(char *v, int order, uint tag)
+{
+  int i;
+
+  for(i = 0; i < (1 << order); i++)
+    *(uint*)(v + i * PGSIZE) = tag + i;
+}
+
+static int
+buddy_check(char *v, int order, uint tag)
+{
+  int i;
+
+  for(i = 0; i < (1 << order); i++)
+    if(*(uint*)(v + i * PGSIZE) != tag + i)
+      return -1;
+  return 0;
+}
+
+// Allocate and free blocks of random orders for the given number of
+// rounds, keeping up to BUDDYTEST_SLOTS blocks alive at once. Small orders
+// are picked more often, as in real use. Each block must be aligned to its
+// size and keep what was written into it until it is freed, and once
+// everything is freed the buddy lists must hold as many pages as before.
+// Returns the number of errors, or -1 on bad arguments.
+int
+buddytest(int rounds, uint seed)
+{
+  static char *blk[BUDDYTEST_SLOTS];
+  static int ord[BUDDYTEST_SLOTS];
+  static uint busy;
+  uint before, tag[BUDDYTEST_SLOTS];
+  int i, n, order, errors = 0;
+
+  if(rounds <= 0 || rounds > BUDDYTEST_MAX_ROUNDS)
+    return -1;
+  // Only one caller at a time may use the slots
+  if(xchg(&busy, 1) != 0)
+    return -1;
+
+  before = buddy_nfree();
+  for(n = 0; n < rounds; n++){
+    i = nextrand(&seed) % BUDDYTEST_SLOTS;
+    if(blk[i]){
+      if(buddy_check(blk[i], ord[i], tag[i]) < 0)
+        errors++;
+      kfree_pages(blk[i], ord[i]);
+      blk[i] = 0;
+      continue;
+    }
+    // Order k with probability about 2^-(k+1)
+    order = __builtin_ctz(nextrand(&seed) | (1 << KMAXORDER));
+    if((blk[i] = kalloc_pages(order)) == 0)
+      continue;
+    if((uint)blk[i] % (PGSIZE << order))
+      errors++;
+    ord[i] = order;
+    tag[i] = nextrand(&seed);
+    buddy_stamp(blk[i], order, tag[i]);
+  }
+
+  for(i = 0; i < BUDDYTEST_SLOTS; i++){
+    if(blk[i] == 0)
+      continue;
+    if(buddy_check(blk[i], ord[i], tag[i]) < 0)
+      errors++;
+    kfree_pages(blk[i], ord[i]);
+    blk[i] = 0;
+  }
+  if(buddy_nfree() != before)
+    errors++;
+  xchg(&busy, 0);
+  return errors;
+}
+
+// Wrapper for buddytest
+int
+sys_buddytest(void)
+{
+  int rounds, seed;
+
+  if(argint(0, &rounds) < 0 || argint(1, &seed) < 0)
+    return -1;
+  return buddytest(rounds, seed);
+}
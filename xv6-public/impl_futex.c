@@ -0,0 +1,170 @@
+// Fast user-space mutexes.
+//
+// A futex is an int in user memory. Its owner changes it with atomic
+// instructions and only calls into the kernel to sleep while the word
+// still holds an expected value, or to wake the lwps sleeping on it.
+// Waiters are keyed on (pgdir, user address), so the lwps of one process
+// share a futex while another process using the same address does not.
+// Each bucket keeps its waiters in FIFO order and, like sleep and wakeup,
+// the table is serialized by ptable.lock. The semaphores of semaphore.c
+// queue their waiters here as well.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "lwp.h"
+#include "futex.h"
+
+#define FUTEX_SHIFT 6
+#define NFUTEX (1 << FUTEX_SHIFT)
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+static struct {
+  struct lwp *head;
+  struct lwp **tail; // Link the next waiter is stored into
+} futexq[NFUTEX];
+
+static inline uint
+futex_hash(pde_t *pgdir, uint uva)
+{
+  return (((uint)pgdir ^ uva) * 2654435761U) >> (32 - FUTEX_SHIFT);
+}
+
+static void
+futex_link(struct lwp *lwp)
+{
+  int h = futex_hash(lwp->fx_pgdir, lwp->fx_uva);
+
+  if(futexq[h].tail == 0)
+    futexq[h].tail = &futexq[h].head;
+  lwp->fx_next = 0;
+  lwp->fx_pprev = futexq[h].tail;
+  *futexq[h].tail = lwp;
+  futexq[h].tail = &lwp->fx_next;
+}
+
+static void
+futex_unlink(struct lwp *lwp)
+{
+  int h = futex_hash(lwp->fx_pgdir, lwp->fx_uva);
+
+  if(lwp->fx_pprev == 0)
+    return;
+  if((*lwp->fx_pprev = lwp->fx_next) != 0)
+    lwp->fx_next->fx_pprev = lwp->fx_pprev;
+  else
+    futexq[h].tail = lwp->fx_pprev;
+  lwp->fx_next = 0;
+  lwp->fx_pprev = 0;
+}
+
+// Queue the current lwp of p on (pgdir, uva) behind the earlier waiters.
+// The caller must hold ptable.lock and then call futex_sleep().
+void
+futex_enqueue(struct proc *p, pde_t *pgdir, uint uva)
+{
+  struct lwp *lwp = mylwp(p);
+
+  lwp->fx_pgdir = pgdir;
+  lwp->fx_uva = uva;
+  futex_link(lwp);
+}
+
+// Sleep until futex_wake() dequeues the current lwp of p.
+// Returns -1 if the process was killed first, in which case
+// the lwp has left the queue by itself.
+// The caller must hold ptable.lock.
+int
+futex_sleep(struct proc *p)
+{
+  struct lwp *lwp = mylwp(p);
+
+  while(lwp->fx_pprev != 0) {
+    if(p->killed) {
+      futex_unlink(lwp);
+      return -1;
+    }
+    sleep(&lwp->fx_pprev, &ptable.lock);
+  }
+  return 0;
+}
+
+// Wake up at most n lwps waiting on (pgdir, uva), oldest first.
+// Returns the number of lwps woken.
+int
+futex_wake(pde_t *pgdir, uint uva, int n)
+{
+  struct lwp *lwp, *next;
+  int woken = 0;
+
+  acquire(&ptable.lock);
+  lwp = futexq[futex_hash(pgdir, uva)].head;
+  for(; lwp != 0 && woken < n; lwp = next) {
+    next = lwp->fx_next;
+    if(lwp->fx_pgdir != pgdir || lwp->fx_uva != uva)
+      continue;
+    futex_unlink(lwp);
+    woken++;
+    if(lwp->state == LWP_SLEEPING && lwp->chan == &lwp->fx_pprev) {
+      waitq_remove(lwp);
+      wakeup_lwp(lwp->wq_proc, lwp);
+    }
+  }
+  release(&ptable.lock);
+  return woken;
+}
+
+// Sleep the current lwp on uva while the word there equals val.
+// Returns 0 when woken by FUTEX_WAKE, -1 if the word differed,
+// uva is not a valid word, or the process was killed.
+static int
+futex_wait(uint uva, int val)
+{
+  struct proc *p = myproc();
+  int cur, ret;
+
+  acquire(&ptable.lock);
+  // Read the word under the lock so a wake cannot slip in between
+  if(fetchint(uva, &cur) < 0 || cur != val) {
+    release(&ptable.lock);
+    return -1;
+  }
+  futex_enqueue(p, p->pgdir, uva);
+  ret = futex_sleep(p);
+  release(&ptable.lock);
+  return ret;
+}
+
+int
+futex(int *addr, int op, int val)
+{
+  uint uva = (uint)addr;
+
+  if(uva % sizeof(int) != 0)
+    return -1;
+  switch(op) {
+  case FUTEX_WAIT:
+    return futex_wait(uva, val);
+  case FUTEX_WAKE:
+    return val > 0 ? futex_wake(myproc()->pgdir, uva, val) : 0;
+  }
+  return -1;
+}
+
+// Wrapper for futex
+int
+sys_futex(void)
+{
+  int addr, op, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex((int*)addr, op, val);
+}
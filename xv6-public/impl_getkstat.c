@@ -0,0 +1,51 @@
+#include "types.h"
+#include "x86.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "schedulers.h"
+#include "kstat.h"
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+// Fill st with a snapshot of the kernel statistics.
+// The counters are read without locks, so they may be slightly stale.
+int
+getkstat(struct kstat *st)
+{
+  struct cpu *c;
+
+  memset(st, 0, sizeof(*st));
+  st->ticks = getticks();
+  st->ncpu = ncpu;
+  st->ptable_acquire = ptable.lock.nacquire;
+  st->wakeup_visits = waitq_nvisit;
+  st->stride_share = stride_all_share();
+  st->kalloc_pages = kalloc_count();
+  kalloc_stat(st->buddy_free);
+  for(c = cpus; c < &cpus[ncpu]; c++) {
+    st->nswtch += c->nswtch;
+    st->nhalt += c->nhalt;
+    st->nipi += c->nipi;
+    st->mlfq_npick += c->mlfq_npick;
+    st->mlfq_pick_cycles += c->mlfq_pick_cycles;
+  }
+  return 0;
+}
+
+// Wrapper for getkstat
+int
+sys_getkstat(void)
+{
+  struct kstat *st;
+
+  if(argptrw(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return getkstat(st);
+}
@@ -18,10 +18,8 @@ extern struct {
 int
 getlev(void)
 {
-  struct proc *p = myproc();
-  acquire(&ptable.lock);
-  uint lev = p->lev;
-  release(&ptable.lock);
+  // A single aligned word is read atomically, no lock needed
+  uint lev = myproc()->lev;
   if(0 <= lev && lev < NMLFQ)
     return lev;
   return -1;
@@ -0,0 +1,89 @@
+#include "types.h"
+#include "x86.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define LOCKBENCH_MAX_TICKS 1000
+#define LOCKCYCLES_MAX_PAIRS 1000000
+
+// One lock of every kind for lockbench()
+static struct spinlock benchlock[] = {
+  [SPIN_TAS]    { .kind = SPIN_TAS,    .name = "bench_tas" },
+  [SPIN_TICKET] { .kind = SPIN_TICKET, .name = "bench_ticket" },
+  [SPIN_MCS]    { .kind = SPIN_MCS,    .name = "bench_mcs" },
+};
+static volatile uint benchcount; // Written in the critical section
+
+// Acquire and release the lock of the given kind in a loop for nticks
+// ticks. Returns the number of acquisitions made by the caller, so lwps
+// calling it at once on several cpus measure contention and fairness.
+int
+lockbench(int kind, int nticks)
+{
+  struct spinlock *lk;
+  uint start, n = 0;
+
+  if(kind < 0 || kind >= NELEM(benchlock) || nticks <= 0 ||
+     nticks > LOCKBENCH_MAX_TICKS)
+    return -1;
+  lk = &benchlock[kind];
+  start = getticks();
+  while(getticks() - start < nticks) {
+    acquire(lk);
+    benchcount++;
+    release(lk);
+    n++;
+  }
+  return n;
+}
+
+// Average TSC cycles of one uncontended acquire/release pair on the lock
+// of the given kind, over n pairs run with interrupts off. Compare
+// kernels built with BUILD=debug and BUILD=release.
+int
+lockcycles(int kind, int n)
+{
+  struct spinlock *lk;
+  unsigned long long start;
+  uint cycles;
+  int i;
+
+  if(kind < 0 || kind >= NELEM(benchlock) || n <= 0 ||
+     n > LOCKCYCLES_MAX_PAIRS)
+    return -1;
+  lk = &benchlock[kind];
+  pushcli();
+  start = rdtsc();
+  for(i = 0; i < n; i++) {
+    acquire(lk);
+    release(lk);
+  }
+  cycles = rdtsc() - start;
+  popcli();
+  return cycles / n;
+}
+
+// Wrapper for lockbench
+int
+sys_lockbench(void)
+{
+  int kind, nticks;
+
+  if(argint(0, &kind) < 0 || argint(1, &nticks) < 0)
+    return -1;
+  return lockbench(kind, nticks);
+}
+
+// Wrapper for lockcycles
+int
+sys_lockcycles(void)
+{
+  int kind, n;
+
+  if(argint(0, &kind) < 0 || argint(1, &n) < 0)
+    return -1;
+  return lockcycles(kind, n);
+}
@@ -0,0 +1,187 @@
+#include "types.h"
+#include "x86.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+// Mask of the cpus which are up
+static uint
+online_mask(void)
+{
+  return (1 << ncpu) - 1;
+}
+
+// The process with the given pid, or the caller if pid is 0.
+// The caller must hold ptable.lock.
+static struct proc *
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid == 0)
+    return myproc();
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pid == pid && p->state != UNUSED)
+      return p;
+  return 0;
+}
+
+// The lwp of the calling process with the given tid.
+// The caller must hold ptable.lock.
+static struct lwp *
+findlwp(thread_t tid)
+{
+  struct proc *curproc = myproc();
+  struct lwp **p_lwp;
+
+  for(p_lwp = curproc->lwps; p_lwp < &curproc->lwps[NLWPS]; p_lwp++)
+    if(*p_lwp && (*p_lwp)->tid == tid && (*p_lwp)->state != LWP_ZOMBIE)
+      return *p_lwp;
+  return 0;
+}
+
+// Would every live lwp of p still have a cpu to run on if p were
+// restricted to pmask and lwp t (if any) to tmask? An lwp left without
+// one would stay runnable forever. The caller must hold ptable.lock.
+static int
+affinity_ok(struct proc *p, uint pmask, struct lwp *t, uint tmask)
+{
+  struct lwp **p_lwp;
+  uint mask;
+
+  for(p_lwp = p->lwps; p_lwp < &p->lwps[NLWPS]; p_lwp++) {
+    if(*p_lwp == 0 || (*p_lwp)->state == LWP_ZOMBIE)
+      continue;
+    mask = *p_lwp == t ? tmask : (*p_lwp)->affinity;
+    if((pmask & mask & online_mask()) == 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Restrict process pid (0 for the caller) to the cpus in mask.
+// Bits of cpus which are not up are ignored. Fails if some lwp of
+// the process could then run nowhere.
+int
+sched_setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+
+  if((mask &= online_mask()) == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0 || !affinity_ok(p, mask, 0, 0)) {
+    release(&ptable.lock);
+    return -1;
+  }
+  p->affinity = mask;
+  release(&ptable.lock);
+
+  // Let the scheduler move the caller if this cpu is not allowed anymore
+  if(p == myproc())
+    yield();
+  return 0;
+}
+
+int
+sched_getaffinity(int pid)
+{
+  struct proc *p;
+  int mask = -1;
+
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) != 0)
+    mask = p->affinity & online_mask();
+  release(&ptable.lock);
+  return mask;
+}
+
+// Restrict lwp tid of the calling process to the cpus in mask.
+// An lwp only runs where both its own mask and the mask of its
+// process allow it, so the masks must overlap.
+int
+thread_setaffinity(thread_t tid, uint mask)
+{
+  struct proc *curproc = myproc();
+  struct lwp *lwp;
+
+  if((mask &= online_mask()) == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if((lwp = findlwp(tid)) == 0 ||
+     !affinity_ok(curproc, curproc->affinity, lwp, mask)) {
+    release(&ptable.lock);
+    return -1;
+  }
+  lwp->affinity = mask;
+  release(&ptable.lock);
+
+  if(lwp == mylwp(myproc()))
+    yield();
+  return 0;
+}
+
+int
+thread_getaffinity(thread_t tid)
+{
+  struct lwp *lwp;
+  int mask = -1;
+
+  acquire(&ptable.lock);
+  if((lwp = findlwp(tid)) != 0)
+    mask = lwp->affinity & online_mask();
+  release(&ptable.lock);
+  return mask;
+}
+
+// Wrapper for sched_setaffinity
+int
+sys_sched_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return sched_setaffinity(pid, mask);
+}
+
+// Wrapper for sched_getaffinity
+int
+sys_sched_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return sched_getaffinity(pid);
+}
+
+// Wrapper for thread_setaffinity
+int
+sys_thread_setaffinity(void)
+{
+  int tid, mask;
+
+  if(argint(0, &tid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return thread_setaffinity(tid, mask);
+}
+
+// Wrapper for thread_getaffinity
+int
+sys_thread_getaffinity(void)
+{
+  int tid;
+
+  if(argint(0, &tid) < 0)
+    return -1;
+  return thread_getaffinity(tid);
+}
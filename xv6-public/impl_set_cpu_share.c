@@ -18,23 +18,32 @@ int
 set_cpu_share(int share)
 {
   int ret = 0;
-  StrideItem stride_item;
   struct proc *p = myproc();
+
+  // Turn down a share which cannot fit without taking ptable.lock;
+  // the check is repeated under the lock
+  if(!stride_can_change_share(is_stride(p) ? p->stride_share : 0, share))
+    return -1;
+
   acquire(&ptable.lock);
   if(is_mlfq(p)) {
-    if(!stride_can_change_share(0, share)) {
+    // Reserve the share
+    if(stride_join(p, share) < 0) {
       ret = -1;
       release(&ptable.lock);
       return ret;
     }
 
-    // Initialize the stride item
-    p->lev = STRIDE_PROC_LEVEL;
-    p->cticks = 0;
-    stride_item_init(&stride_item, share, p, 0);
+    // Other lwps of p may still wait in an MLFQ queue
+    if(p->state == RUNNABLE) {
+      mlfq_remove(p);
+      if(sched_policy == SCHED_MLFQ)
+        mlfq_push(p);
+    }
 
-    // Push it to the Stride queue
-    if((ret = stride_push(&stride_item))) {
+    // Push it to the Stride queue if the stride scheduler is in use.
+    // Under the other policies it only keeps the reservation.
+    if(sched_policy == SCHED_STRIDE && (ret = stride_wakeup(p))) {
       panic("The process cannot be pushed into StrideQ");
     }
 
@@ -45,8 +54,8 @@ set_cpu_share(int share)
 
     return ret;
   } else if(is_stride(p)) {
-    // Find the stride item and adjust the share value
-    ret = stride_adjust(stride_find_item(p), share);
+    // Adjust the share value
+    ret = stride_set_share(p, share);
   } else {
     ret = -1;
   }
@@ -0,0 +1,28 @@
+#include "types.h"
+#include "x86.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "schedulers.h"
+
+// Switch every cpu to the given scheduling policy (see sched.h).
+// Returns the previous policy, or -1 if policy is invalid.
+int
+set_sched_policy(int policy)
+{
+  return sched_switch(policy);
+}
+
+// Wrapper for set_sched_policy
+int
+sys_set_sched_policy(void)
+{
+  int policy;
+
+  if(argint(0, &policy) < 0)
+    return -1;
+  return set_sched_policy(policy);
+}
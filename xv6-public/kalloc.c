@@ -1,6 +1,13 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous blocks of 2^order pages through kalloc_pages().
+//
+// Free memory is kept by a buddy allocator: a free list per order of
+// naturally aligned blocks. Allocating splits a larger block in halves
+// as needed, and freeing merges a block with its buddy, the other half
+// of the block they were split from, whenever that one is free too.
+// Single pages mostly go through per-cpu magazines in front of it.
 
 #include "types.h"
 #include "defs.h"
@@ -15,14 +22,166 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev; // Only for blocks on a buddy free list
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[KMAXORDER + 1]; // Free blocks of 2^order pages
+  struct run *zerolist; // Pages zeroed by idle cpus, for kzalloc()
+  int nzero;            // Length of zerolist
 } kmem;
 
+// Order of the block starting at each physical page, with PG_FREE if
+// the block is on a free list. Only meaningful for the first page.
+#define PG_FREE 0x80
+static uchar pgorder[PHYSTOP / PGSIZE];
+
+// Users of each page handed out by kalloc(). Pages shared copy-on-write
+// after fork() are freed by the last of at most NPROC users.
+static uchar pgref[PHYSTOP / PGSIZE];
+
+#define PFN(v) (V2P(v) / PGSIZE)
+#define PFN2V(pfn) ((struct run*)P2V((pfn) * PGSIZE))
+
+static void
+buddy_push(struct run *r, int order)
+{
+  pgorder[PFN(r)] = PG_FREE | order;
+  r->prev = 0;
+  if((r->next = kmem.free[order]) != 0)
+    r->next->prev = r;
+  kmem.free[order] = r;
+}
+
+static void
+buddy_unlink(struct run *r, int order)
+{
+  pgorder[PFN(r)] = order;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+}
+
+// Take a block of 2^order pages. The caller must hold kmem.lock.
+static struct run*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= KMAXORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k > KMAXORDER)
+    return 0;
+  r = kmem.free[k];
+  buddy_unlink(r, k);
+  // Give back the upper halves until the block is small enough
+  while(k > order){
+    k--;
+    buddy_push((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  pgorder[PFN(r)] = order;
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with its free buddies.
+// The caller must hold kmem.lock.
+static void
+buddy_free(struct run *r, int order)
+{
+  uint pfn = PFN(r), buddy;
+
+  for(; order < KMAXORDER; order++){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= PHYSTOP / PGSIZE || pgorder[buddy] != (PG_FREE | order))
+      break;
+    buddy_unlink(PFN2V(buddy), order);
+    pfn &= ~(1 << order);
+  }
+  buddy_push(PFN2V(pfn), order);
+}
+
+#define KZERO_TARGET 256 // Pages idle cpus keep zeroed in advance
+
+// Per-cpu magazines of free pages. kalloc() and kfree() work on the
+// magazine of their cpu with interrupts off and only take kmem.lock to
+// move KMAG_BATCH pages at once between it and the buddy lists.
+// At most NCPU * KMAG_SIZE pages sit in magazines.
+#define KMAG_SIZE  32
+#define KMAG_BATCH (KMAG_SIZE / 2)
+
+static struct {
+  struct run *list;
+  int n;
+  uint nalloc; // Pages handed out on this cpu, for getkstat()
+} kmag[NCPU];
+
+// Take a page zeroed in advance, or 0 if there is none.
+// The caller must hold kmem.lock.
+static struct run*
+kzero_pop(void)
+{
+  struct run *r;
+
+  if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  return r;
+}
+
+// Take up to KMAG_BATCH pages from the buddy lists into the magazine
+// of cpu. Once those run out, the pages zeroed in advance are used too
+// rather than failing while they are still free.
+static void
+kmag_refill(int cpu)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(kmag[cpu].n < KMAG_BATCH &&
+        ((r = buddy_alloc(0)) != 0 || (r = kzero_pop()) != 0)){
+    r->next = kmag[cpu].list;
+    kmag[cpu].list = r;
+    kmag[cpu].n++;
+  }
+  release(&kmem.lock);
+}
+
+// Give KMAG_BATCH pages of a full magazine back to the buddy lists.
+static void
+kmag_drain(int cpu)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KMAG_BATCH; i++){
+    r = kmag[cpu].list;
+    kmag[cpu].list = r->next;
+    kmag[cpu].n--;
+    buddy_free(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Pages handed out by kalloc() on all cpus since boot
+uint
+kalloc_count(void)
+{
+  uint n = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    n += kmag[i].nalloc;
+  return n;
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +190,7 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  initlock_kind(&kmem.lock, "kmem", SPIN_TICKET);
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -43,13 +202,20 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Give the pages of [vstart, vend) to the buddy allocator at boot.
+// Nothing can refer to them yet, so unlike kfree() this only writes the
+// list links instead of touching all of memory before init runs.
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
+
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    if(V2P(p) >= PHYSTOP)
+      panic("freerange");
+    buddy_free((struct run*)p, 0);
+  }
 }
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
@@ -60,20 +226,32 @@ void
 kfree(char *v)
 {
   struct run *r;
+  int cpu;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP || pgref[PFN(v)] == 0)
     panic("kfree");
+  if(__sync_sub_and_fetch(&pgref[PFN(v)], 1) != 0)
+    return; // Still shared
 
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Still booting on one cpu, before seginit() gave us cpuid()
+    buddy_free(r, 0);
+    return;
+  }
+
+  pushcli();
+  cpu = cpuid();
+  r->next = kmag[cpu].list;
+  kmag[cpu].list = r;
+  if(++kmag[cpu].n > KMAG_SIZE)
+    kmag_drain(cpu);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +261,157 @@ char*
 kalloc(void)
 {
   struct run *r;
+  int cpu;
+
+  if(!kmem.use_lock){
+    if((r = buddy_alloc(0)) != 0)
+      pgref[PFN(r)] = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  cpu = cpuid();
+  if(kmag[cpu].n == 0)
+    kmag_refill(cpu);
+  if((r = kmag[cpu].list) != 0){
+    kmag[cpu].list = r->next;
+    kmag[cpu].n--;
+    kmag[cpu].nalloc++;
+    pgref[PFN(r)] = 1;
+  }
+  popcli();
+  return (char*)r;
+}
 
-  if(kmem.use_lock)
+// Allocate one zeroed page, preferably one zeroed ahead of time by
+// kzero_idle(). Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  struct run *r = 0;
+  int cpu;
+
+  // Peek without the lock so that an empty pool costs nothing
+  if(kmem.use_lock && kmem.nzero > 0){
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    r = kzero_pop();
     release(&kmem.lock);
+  }
+  if(r == 0){
+    if((r = (struct run*)kalloc()) != 0)
+      memset(r, 0, PGSIZE);
+    return (char*)r;
+  }
+  r->next = 0; // The only word which was not zero
+  pgref[PFN(r)] = 1;
+  pushcli();
+  cpu = cpuid();
+  kmag[cpu].nalloc++;
+  popcli();
   return (char*)r;
 }
 
+// Called by a cpu with nothing to run: zero one free page for
+// kzalloc() unless enough are zeroed already.
+// Returns 1 if it did some work, 0 if the cpu may halt.
+int
+kzero_idle(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock || kmem.nzero >= KZERO_TARGET)
+    return 0;
+  acquire(&kmem.lock);
+  r = buddy_alloc(0);
+  release(&kmem.lock);
+  if(r == 0)
+    return 0;
+
+  memset(r, 0, PGSIZE);
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Add a user to a page from kalloc(), which kfree() then frees only
+// once every user freed it.
+void
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP || pgref[PFN(v)] == 0)
+    panic("kdup");
+  __sync_add_and_fetch(&pgref[PFN(v)], 1);
+}
+
+// Number of users of a page from kalloc()
+int
+krefcount(char *v)
+{
+  return pgref[PFN(v)];
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Returns 0 if no block that large is free.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+  int cpu;
+
+  if(order < 0 || order > KMAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  if((r = buddy_alloc(order)) == 0 && kmem.zerolist){
+    // The pages zeroed in advance may merge into a large enough block
+    while((r = kzero_pop()) != 0)
+      buddy_free(r, 0);
+    r = buddy_alloc(order);
+  }
+  release(&kmem.lock);
+  if(r == 0)
+    return 0;
+  pushcli();
+  cpu = cpuid();
+  kmag[cpu].nalloc += 1 << order;
+  popcli();
+  return (char*)r;
+}
+
+// Free a block which kalloc_pages(order) returned.
+void
+kfree_pages(char *v, int order)
+{
+  if(order < 0 || order > KMAXORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP ||
+     pgorder[PFN(v)] != order)
+    panic("kfree_pages");
+
+#ifdef KALLOC_DEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free((struct run*)v, order);
+  release(&kmem.lock);
+}
+
+// Count the free blocks of each order into nfree[0..KMAXORDER].
+// Pages cached in magazines or zeroed in advance are not included.
+void
+kalloc_stat(uint *nfree)
+{
+  struct run *r;
+  int order;
+
+  acquire(&kmem.lock);
+  for(order = 0; order <= KMAXORDER; order++){
+    nfree[order] = 0;
+    for(r = kmem.free[order]; r != 0; r = r->next)
+      nfree[order]++;
+  }
+  release(&kmem.lock);
+}
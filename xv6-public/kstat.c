@@ -0,0 +1,92 @@
+/**
+ * Run a command and report how the kernel statistics changed meanwhile,
+ * e.g. `kstat usertests`. Without arguments, print the current counters.
+ *
+ * Boot with `make qemu CPUS=4` to compare the idle paths on -smp 4:
+ * the ptable.lock acquisitions and the elapsed ticks of the command.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Free buddy blocks per order, and how fragmented the free memory is:
+// the percentage of free pages which sit in blocks too small for a
+// 2^FRAG_ORDER page allocation.
+#define FRAG_ORDER 4
+
+static void
+print_buddy(struct kstat *st)
+{
+  uint order, pages, nfree = 0, small = 0;
+
+  printf(1, "  buddy blocks  ");
+  for(order = 0; order < KSTAT_NORDER; order++) {
+    printf(1, " %d", st->buddy_free[order]);
+    pages = st->buddy_free[order] << order;
+    nfree += pages;
+    if(order < FRAG_ORDER)
+      small += pages;
+  }
+  printf(1, "\n");
+  printf(1, "  buddy free     %d pages, %d%% unusable for order %d\n", nfree,
+         nfree ? small * 100 / nfree : 0, FRAG_ORDER);
+}
+
+static void
+print(const char *title, struct kstat *st)
+{
+  printf(1, "%s\n", title);
+  printf(1, "  ticks          %d\n", st->ticks);
+  printf(1, "  cpus           %d\n", st->ncpu);
+  printf(1, "  ptable.lock    %d acquisitions\n", st->ptable_acquire);
+  printf(1, "  switches       %d\n", st->nswtch);
+  printf(1, "  halts          %d\n", st->nhalt);
+  printf(1, "  resched IPIs   %d\n", st->nipi);
+  printf(1, "  wakeup visits  %d lwps\n", st->wakeup_visits);
+  printf(1, "  stride share   %d\n", st->stride_share);
+  printf(1, "  kalloc         %d pages\n", st->kalloc_pages);
+  print_buddy(st);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after, delta;
+  int pid;
+
+  if(getkstat(&before) < 0) {
+    printf(2, "kstat: getkstat failed\n");
+    exit();
+  }
+  if(argc < 2) {
+    print("kernel statistics", &before);
+    exit();
+  }
+
+  if((pid = fork()) < 0) {
+    printf(2, "kstat: fork failed\n");
+    exit();
+  }
+  if(pid == 0) {
+    exec(argv[1], argv + 1);
+    printf(2, "kstat: exec %s failed\n", argv[1]);
+    exit();
+  }
+  wait();
+  getkstat(&after);
+
+  delta.ticks = after.ticks - before.ticks;
+  delta.ncpu = after.ncpu;
+  delta.ptable_acquire = after.ptable_acquire - before.ptable_acquire;
+  delta.nswtch = after.nswtch - before.nswtch;
+  delta.nhalt = after.nhalt - before.nhalt;
+  delta.nipi = after.nipi - before.nipi;
+  delta.wakeup_visits = after.wakeup_visits - before.wakeup_visits;
+  delta.stride_share = after.stride_share;
+  delta.kalloc_pages = after.kalloc_pages - before.kalloc_pages;
+  memmove(delta.buddy_free, after.buddy_free, sizeof(delta.buddy_free));
+  print(argv[1], &delta);
+  exit();
+}
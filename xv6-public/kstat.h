@@ -0,0 +1,18 @@
+#pragma once
+#define KSTAT_NORDER 11 // Buddy orders, KMAXORDER + 1
+
+// Kernel statistics, summed over all cpus. See getkstat().
+struct kstat {
+  uint ticks;           // Timer ticks since boot
+  uint ncpu;            // Number of cpus
+  uint ptable_acquire;  // Acquisitions of ptable.lock
+  uint nswtch;          // Switches from the scheduler into a process
+  uint nhalt;           // Times an idle cpu executed hlt
+  uint nipi;            // Reschedule IPIs received
+  uint mlfq_npick;      // Processes picked by the MLFQ scheduler
+  uint mlfq_pick_cycles; // TSC cycles spent in those picks (wraps)
+  uint wakeup_visits;   // Sleeping lwps looked at by wakeups
+  uint stride_share;    // Cpu share reserved by the MLFQ and stride
+  uint kalloc_pages;    // Pages handed out by kalloc()
+  uint buddy_free[KSTAT_NORDER]; // Free buddy blocks of 2^order pages
+};
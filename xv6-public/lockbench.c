@@ -0,0 +1,107 @@
+/**
+ * This program measures kernel spin locks under contention. One lwp per
+ * cpu, each pinned to its cpu, acquires and releases the same kernel lock
+ * in lockbench() for DURATION ticks. For every lock kind and for 2, 4 and
+ * 8 cpus it reports the acquisitions per second of all cpus together and
+ * the fairness spread, (max - min) / average of the per-cpu counts.
+ * Counts for more cpus than the kernel was booted with are skipped, so
+ * run it with CPUS=8.
+ *
+ * It first reports the cycles of one uncontended acquire/release pair of
+ * every kind, which depend on the BUILD the kernel was made with.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define DURATION 100
+#define MAXCPUS 8
+#define NPAIRS 100000
+
+#ifdef SPINLOCK_DEBUG
+#define BUILD_NAME "debug"
+#else
+#define BUILD_NAME "release"
+#endif
+
+static const char *kinds[] = {
+  [SPIN_TAS]    "test-and-set",
+  [SPIN_TICKET] "ticket      ",
+  [SPIN_MCS]    "MCS         ",
+};
+
+static int kind;
+static volatile int start;
+static int counts[MAXCPUS];
+
+void *
+worker(void *arg)
+{
+  int id = (int)arg;
+
+  while(uptime() < start)
+    ;
+  counts[id] = lockbench(kind, DURATION);
+  thread_exit(0);
+  return 0;
+}
+
+static void
+run(int ncpus)
+{
+  thread_t t[MAXCPUS];
+  void *ret;
+  int i, min, max, total = 0;
+
+  start = uptime() + 10;
+  for(i = 0; i < ncpus; i++) {
+    if(thread_create(&t[i], worker, (void *)i) < 0 ||
+       thread_setaffinity(t[i], 1 << i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(i = 0; i < ncpus; i++)
+    thread_join(t[i], &ret);
+
+  min = max = counts[0];
+  for(i = 0; i < ncpus; i++) {
+    if(counts[i] < 0) {
+      printf(1, "lockbench failed\n");
+      exit();
+    }
+    total += counts[i];
+    if(counts[i] < min)
+      min = counts[i];
+    if(counts[i] > max)
+      max = counts[i];
+  }
+  printf(1, "  %s %d acquisitions/sec, spread %d%%\n", kinds[kind],
+         total / DURATION * 100, total >= ncpus ? (max - min) * 100 / (total / ncpus) : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat st;
+  int ncpus;
+
+  printf(1, "%s build, uncontended\n", BUILD_NAME);
+  for(kind = SPIN_TAS; kind <= SPIN_MCS; kind++)
+    printf(1, "  %s %d cycles per acquire/release\n", kinds[kind],
+           lockcycles(kind, NPAIRS));
+
+  getkstat(&st);
+  for(ncpus = 2; ncpus <= MAXCPUS; ncpus *= 2) {
+    if(ncpus > st.ncpu) {
+      printf(1, "%d cpus: skipped, booted with %d\n", ncpus, st.ncpu);
+      continue;
+    }
+    printf(1, "%d cpus, %d ticks\n", ncpus, DURATION);
+    for(kind = SPIN_TAS; kind <= SPIN_MCS; kind++)
+      run(ncpus);
+  }
+  exit();
+}
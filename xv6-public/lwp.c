@@ -6,20 +6,18 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "lwp.h"
+#include "slab.h"
 
 extern struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
-struct spinlock lwplock;
-static uint used[(MAX_LWPS + 7) / 8];
-static struct lwp lwps[MAX_LWPS];
+static struct kmem_cache lwpcache;
 
 extern void trapret(void);
 
 static void thread_init(void);
-static void switchlwpkm(struct lwp *lwp);
 static struct lwp ** find_empty_lwp(void);
 static void wakeup1(void *chan);
 static int all_lwp(struct lwp** lwps, enum lwpstate s);
@@ -32,7 +30,7 @@ sys_thread_create(void)
   void *(*start_routine)(void *);
   void *arg;
 
-  if(argint(0, (int *)&thread) < 0)
+  if(argptrw(0, (char **)&thread, sizeof(*thread)) < 0)
     return -1;
   if(argptr(1, (char **)&start_routine, 4) < 0)
     return -1;
@@ -60,7 +58,7 @@ sys_thread_join(void)
   void **ret_val;
   if(argint(0, (int*)&thread) < 0)
     return -1;
-  if(argptr(1, (char **)&ret_val, 4) < 0)
+  if(argptrw(1, (char **)&ret_val, sizeof(*ret_val)) < 0)
     return -1;
   return thread_join(thread, ret_val);
 }
@@ -103,9 +101,6 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
   lwp->context->eip = (uint)thread_init;
   lwp->context->ebp = (uint)lwp->kstack + KSTACKSIZE;
 
-  // Set the lwp runnable
-  lwp->state = LWP_RUNNABLE;
-
   struct lwp **p_lwp = find_empty_lwp();
   if(!p_lwp) {
     kfree(lwp->kstack);
@@ -148,10 +143,12 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
   lwp->tf->eip = (uint)start_routine;
   *thread = lwp->tid = curproc->lwp_cnt++;
   lwp->ptid = mylwp(curproc)->tid;
+  lwp->affinity = mylwp(curproc)->affinity;
 
-  // 현재 프로세스에 lwp추가
+  // 현재 프로세스에 lwp추가 and let an idle cpu run it
   acquire(&ptable.lock);
   *p_lwp = lwp;
+  wakeup_lwp(curproc, lwp);
   release(&ptable.lock);
 
   return 0;
@@ -172,33 +169,37 @@ thread_join(thread_t thread, void **ret_val)
         ++p_lwp) {
       if((*p_lwp) && (*p_lwp)->tid == thread) {
         found = 1;
-        if((*p_lwp)->state != LWP_ZOMBIE)
+        // A zombie without a stack is being joined by another lwp
+        if((*p_lwp)->state != LWP_ZOMBIE || (*p_lwp)->stack_sz == 0)
           continue;
 
+        struct lwp *lwp = *p_lwp;
         uint stack_sz = 2 * PGSIZE;
         uint stack_base = stack_base_lwp(p_lwp);
+        void *val = lwp->ret_val;
 
-        // Copy the return value
-        *ret_val = (*p_lwp)->ret_val;
-
-        // 유저 스택 메모리 해제
-        if((deallocuvm(curproc->pgdir, stack_base, stack_base - stack_sz)) == 0) {
-          panic("cannot dealloc user stacks");
-        }
-
-        // 커널 스택 메모리 해제
-        kfree((*p_lwp)->kstack);
+        // 유저 스택 매핑 해제. The slot stays taken until the pages are
+        // freed, so that no new lwp maps its stack there meanwhile.
+        unmapuvm(curproc->pgdir, stack_base, stack_base - stack_sz);
+        lwp->stack_sz = 0;
+        release(&ptable.lock);
 
-        // 커널 스택 메모리 초기화
-        (*p_lwp)->kstack = 0;
+        // Other cpus may still cache the stack; never with ptable.lock held
+        tlbshootdown(curproc);
 
-        // lwp 해제
-        dealloclwp(*p_lwp);
+        // 유저 스택과 커널 스택 메모리 해제
+        freeuvm(curproc->pgdir, stack_base, stack_base - stack_sz);
+        kfree(lwp->kstack);
+        lwp->kstack = 0;
 
-        // lwp 슬롯 초기화
+        // lwp 슬롯 초기화 및 해제
+        acquire(&ptable.lock);
         *p_lwp = 0;
-
         release(&ptable.lock);
+        dealloclwp(lwp);
+
+        // Copy the return value, which may fault, with no lock held
+        *ret_val = val;
         kprintf_info("thread join pid = %d, tid = %d\n", curproc->pid, thread);
         return 0;
       }
@@ -253,101 +254,58 @@ thread_exit(void *ret_val)
 
     kprintf_info("thread_exit at pid = %d, tid = %d\n", curproc->pid, curlwp->tid);
 
-    struct lwp **p_next_lwp = get_runnable_lwp(curproc);
-    if(p_next_lwp != 0 && p_next_lwp != mylwp1(curproc)) {
-      // If another lwp is runnable, switch to another lwp.
-      swtchlwp1(p_next_lwp);
-    } else {
-      // Otherwise, switch to the kernel scheduler.
-      curproc->state = SLEEPING;
-      sched();
-    }
+    sched();
   }
   panic("zombie thread exit"); // Never returns
 }
 
-struct lwp *
-alloclwp(void)
-{
-  acquire(&lwplock);
-  for(uint i = 0; i < MAX_LWPS / 8; ++i) {
-    if(used[i] == 0xff)
-      continue;
-    for(uint j = 0; j < 8; ++j) {
-      if((used[i] & (1 << j)) == 0) {
-        used[i] |= 1 << j;
-        release(&lwplock);
-        lwps[(i << 3) | j].state = LWP_EMBRYO;
-        return &lwps[(i << 3) | j];
-      }
-    }
-  }
-  release(&lwplock);
-  return 0;
-}
-
 void
-dealloclwp(struct lwp *unused)
+lwpinit(void)
 {
-  if(!(unused >= lwps && unused < lwps + MAX_LWPS))
-    panic("not allocated lwp");
-  uint idx = unused - lwps;
-  acquire(&lwplock);
-  used[idx >> 3] &= ~(1 << (idx & 7)); // used[idx / 8] &= ~(1 << (idx % 8));
-  memset(unused, 0, sizeof *unused);
-  release(&lwplock);
+  kmem_cache_init(&lwpcache, "lwp", sizeof(struct lwp));
 }
 
-void
-swtchlwp(struct lwp **p_lwp)
+struct lwp *
+alloclwp(void)
 {
-  acquire(&ptable.lock);
-  swtchlwp1(p_lwp);
-  release(&ptable.lock);
+  struct lwp *lwp;
+
+  if((lwp = kmem_cache_alloc(&lwpcache)) == 0)
+    return 0;
+  memset(lwp, 0, sizeof *lwp);
+  lwp->state = LWP_EMBRYO;
+  lwp->affinity = ~0;
+  return lwp;
 }
 
 void
-swtchlwp1(struct lwp **p_lwp)
+dealloclwp(struct lwp *unused)
 {
-  struct proc *curproc = myproc();
-  struct lwp *curlwp = mylwp(curproc);
-
-  if(curlwp == *p_lwp)
-    return;
-
-  curproc->lwp_idx = p_lwp - curproc->lwps;
-  if(curproc->lwp_idx >= NLWPS || curproc->lwp_idx < 0){
-    panic("Bad lwp idx");
-  }
-
-  switchlwpkm(*p_lwp);
-
-  kprintf_trace("[before] pid %d switch stack from %d(%d) to %d(%d)\n", curproc->pid, curlwp->tid, curlwp->state, (*p_lwp)->tid, (*p_lwp)->state);
-  (*p_lwp)->state = LWP_RUNNING;
-  kprintf_trace("[ after] pid %d switch stack from %d(%d) to %d(%d)\n", curproc->pid, curlwp->tid, curlwp->state, (*p_lwp)->tid, (*p_lwp)->state);
-
-  int intena = mycpu()->intena;
-  swtch(&curlwp->context, (*p_lwp)->context);
-  mycpu()->intena = intena;
+  if(unused == 0)
+    panic("not allocated lwp");
+  unused->state = LWP_UNUSED;
+  kmem_cache_free(&lwpcache, unused);
 }
 
 struct lwp **
-get_runnable_lwp(struct proc *p)
+get_runnable_lwp(struct proc *p, struct cpu *c)
 {
-  struct lwp *curlwp = mylwp(p);
-
-  int lwp_idx = (p->lwp_idx + 1) % NLWPS;
-  while(lwp_idx != p->lwp_idx) {
-    if(p->lwps[lwp_idx] != 0 && p->lwps[lwp_idx] != curlwp &&
-       p->lwps[lwp_idx]->state == LWP_RUNNABLE)
-      break;
-    lwp_idx = (lwp_idx + 1) % NLWPS;
+  struct lwp *lwp;
+  int i, lwp_idx;
+
+  // Start after the lwp dispatched last to take turns
+  for(i = 1; i <= NLWPS; ++i) {
+    lwp_idx = (p->lwp_idx + i) % NLWPS;
+    lwp = p->lwps[lwp_idx];
+    if(lwp == 0 || lwp->state != LWP_RUNNABLE)
+      continue;
+    if(c != 0 && !lwp_allowed(p, lwp, c))
+      continue;
+    if(lwp->kstack == 0)
+      panic("empty kernel stack");
+    return &p->lwps[lwp_idx];
   }
-  if(p->lwps[lwp_idx]->kstack == 0)
-    panic("empty kernel stack");
-  if(p->lwps[lwp_idx]->state != LWP_RUNNABLE)
-    return 0;
-  return &p->lwps[lwp_idx];
+  return 0;
 }
 
 void
@@ -379,24 +337,10 @@ copy_lwp(struct lwp *dst, const struct lwp *src)
   *dst->tf = *src->tf;
   dst->chan = src->chan;
   dst->ret_val = src->ret_val;
+  dst->affinity = src->affinity;
   return 0;
 }
 
-// Switch TSS to correspond to light-weight process p.
-static void
-switchlwpkm(struct lwp *lwp)
-{
-  if(lwp == 0)
-    panic("switchlwpkm: no main lwp");
-  if(lwp->kstack == 0)
-    panic("switchlwpkm: no kstack");
-
-  pushcli();
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)lwp->kstack + KSTACKSIZE;
-  popcli();
-}
-
 /*
  * struct lwp** find_empty_lwp(void)
  * returns a position to an empty lwp slot of the current process
@@ -423,11 +367,8 @@ wakeup1(void *chan)
   struct proc *p = myproc();
   struct lwp **p_lwp;
   for(p_lwp = p->lwps; p_lwp < &p->lwps[NLWPS]; ++p_lwp) {
-    if((*p_lwp) && (*p_lwp)->state == LWP_SLEEPING && (*p_lwp)->chan == chan) {
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      (*p_lwp)->state = LWP_RUNNABLE;
-    }
+    if((*p_lwp) && (*p_lwp)->state == LWP_SLEEPING && (*p_lwp)->chan == chan)
+      wakeup_lwp(p, *p_lwp);
   }
 }
 
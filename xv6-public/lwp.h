@@ -24,6 +24,17 @@ struct lwp {
   struct context *context; // Pointer to its context
   void *chan;              // Channel to fall a sleep
   void *ret_val;           // Return value
+  uint affinity;           // Mask of cpus this lwp may run on
+  struct lwp *wq_next;     // Next lwp in the wait channel bucket
+  struct lwp **wq_pprev;   // Link pointing at this lwp, 0 if not linked
+  struct proc *wq_proc;    // Process of this lwp while it is linked
+  struct lwp *tm_next;     // Next lwp in the timer wheel slot
+  struct lwp **tm_pprev;   // Link pointing at this lwp, 0 if not linked
+  uint tm_expire;          // Tick to wake up at from sleep()
+  struct lwp *fx_next;     // Next lwp waiting in the futex bucket
+  struct lwp **fx_pprev;   // Link pointing at this lwp, 0 if not waiting
+  pde_t *fx_pgdir;         // Address space of the futex waited on
+  uint fx_uva;             // User address of the futex waited on
 };
 
 /*
@@ -60,9 +71,15 @@ int thread_join(thread_t thread, void **ret_val);
  */
 void thread_exit(void *ret_val);
 
+/*
+ * void lwpinit()
+ * sets up the slab cache which lwp structs are allocated from
+ */
+void lwpinit(void);
+
 /*
  * struct lwp* alloclwp()
- * returns a pointer to an allocated lwp struct otherwise -1
+ * returns a pointer to an allocated lwp struct otherwise 0
  */
 struct lwp *alloclwp(void);
 
@@ -73,23 +90,13 @@ struct lwp *alloclwp(void);
 void dealloclwp(struct lwp *unused);
 
 /*
- * void swtchlwp(void)
- * is same as swtchlwp1(void), but it holds ptable.lock
- */
-void swtchlwp(struct lwp **p_lwp);
-
-/*
- * void swtchlwp1(void)
- * switches the kernel stack of the current lwp
- */
-void swtchlwp1(struct lwp **p_lwp);
-
-/*
- * struct lwp **get_runnable_lwp(struct proc *p)
+ * struct lwp **get_runnable_lwp(struct proc *p, struct cpu *c)
  * fetch a pointer to a runnable lwp pointer in the given process(p)
+ * which may run on the given cpu(c), or on any cpu if c is 0,
  * otherwise, return 0
  */
-struct lwp **get_runnable_lwp(struct proc *p);
+struct cpu;
+struct lwp **get_runnable_lwp(struct proc *p, struct cpu *c);
 
 /*
  * void print_lwps(const struct proc *p)
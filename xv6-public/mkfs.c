@@ -252,6 +252,21 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Entry idx of the indirect block at sector bn,
+// allocating the block it points to if necessary.
+uint
+indirect_entry(uint bn, uint idx)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(bn, (char*)indirect);
+  if(indirect[idx] == 0){
+    indirect[idx] = xint(freeblock++);
+    wsect(bn, (char*)indirect);
+  }
+  return xint(indirect[idx]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +274,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -273,16 +287,19 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = indirect_entry(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      assert(fbn < NDIRECT + NINDIRECT + NDINDIRECT);
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = indirect_entry(xint(din.addrs[NDIRECT+1]),
+                         (fbn - NDIRECT - NINDIRECT) / NINDIRECT);
+      x = indirect_entry(x, (fbn - NDIRECT - NINDIRECT) % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
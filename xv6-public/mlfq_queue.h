@@ -0,0 +1,26 @@
+#ifndef _H_MLFQ_QUEUE_
+#define _H_MLFQ_QUEUE_
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+
+#define NMLFQ 3
+
+struct proc;
+
+// Circular queue of processes for a single MLFQ level
+struct proc_queue {
+  int f, r;
+  struct proc *items[NPROC + 1];
+};
+
+// Per-CPU set of MLFQ level queues.
+// The queues only hold RUNNABLE processes; a process is pushed when it
+// becomes runnable and leaves its queue when it is picked to run.
+struct mlfq_runq {
+  struct spinlock lock;            // Protects the level queues below
+  uint epoch;                      // Last priority boost applied to the queues
+  uint bitmap;                     // Bit lev is set iff q[lev] is not empty
+  struct proc_queue q[NMLFQ];      // Level queues
+};
+#endif
@@ -19,14 +19,8 @@ extern struct {
   struct proc proc[NPROC];
 } ptable;
 
-struct proc_queue {
-  int f, r;
-  struct proc *items[NPROC + 1];
-};
-
-struct spinlock mlfqlock;
 uint mlfq_ticks;
-mlfq_queue_t mlfq[NMLFQ];
+uint mlfq_epoch; // Number of priority boosts so far
 
 static inline int
 queue_size(const mlfq_queue_t *q)
@@ -68,106 +62,300 @@ queue_front(mlfq_queue_t *q)
   return q->items[BEGIN(q)];
 }
 
-static inline struct proc *
-queue_rear(mlfq_queue_t *q)
+// Remove the item at idx while keeping the order of the others
+static void
+queue_remove_at(mlfq_queue_t *q, int idx)
+{
+  for(; idx != q->r; idx = NEXT(idx))
+    q->items[idx] = q->items[NEXT(idx)];
+  q->items[q->r] = 0;
+  q->r = PREV(q->r);
+}
+
+void
+mlfq_init(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->mlfq.lock, "mlfq");
+  mlfq_reset();
+}
+
+// Empty the queues of every cpu, and take back the processes a cpu
+// has just picked. The caller must hold ptable.lock once it is set up.
+void
+mlfq_reset(void)
+{
+  struct cpu *c;
+  struct proc *p;
+
+  for(c = cpus; c < &cpus[NCPU]; c++) {
+    acquire(&c->mlfq.lock);
+    memset(c->mlfq.q, 0, sizeof(c->mlfq.q));
+    c->mlfq.epoch = mlfq_epoch;
+    c->mlfq.bitmap = 0;
+    release(&c->mlfq.lock);
+  }
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    p->mlfq_claim = 0;
+}
+
+// Level of p in the queues. Under the MLFQ-only policy
+// stride processes are queued at the lowest level.
+static inline int
+mlfq_level(struct proc *p)
+{
+  return is_mlfq(p) ? p->lev : NMLFQ - 1;
+}
+
+// Apply a priority boost which happened while p was out of every queue.
+static void
+mlfq_refresh(struct proc *p)
 {
-  return q->items[q->r];
+  if(p->mlfq_epoch == mlfq_epoch || !is_mlfq(p))
+    return;
+  p->mlfq_epoch = mlfq_epoch;
+  p->lev = 0;
+  p->cticks = 0;
 }
 
+// Push a process which has just become runnable into the queues of
+// the current cpu, or of the first cpu its affinity mask allows
 int
 mlfq_push(struct proc *item)
 {
-  if(item->lev < 0 && item->lev >= NMLFQ)
-    return -1;
-  if(queue_rear(&mlfq[item->lev]) == item)
-    return -1;
-  return queue_push_item(&mlfq[item->lev], item);
+  struct mlfq_runq *rq;
+  struct cpu *c;
+  int ret, lev;
+
+  pushcli();
+  rq = &mycpu()->mlfq;
+  if(!proc_allowed(item, mycpu())) {
+    for(c = cpus; c < &cpus[ncpu]; c++) {
+      if(proc_allowed(item, c)) {
+        rq = &c->mlfq;
+        break;
+      }
+    }
+  }
+  acquire(&rq->lock);
+  mlfq_refresh(item);
+  lev = mlfq_level(item);
+  if((ret = queue_push_item(&rq->q[lev], item)) == 0)
+    rq->bitmap |= 1 << lev;
+  release(&rq->lock);
+  popcli();
+  return ret;
+}
+
+// Take p out of whichever queue holds it, if any, or else take it
+// back from the cpu which has just picked it; see mlfq_claimed().
+// The caller must hold ptable.lock.
+void
+mlfq_remove(struct proc *p)
+{
+  struct cpu *c;
+  struct mlfq_runq *rq;
+  int lev, idx;
+
+  for(c = cpus; c < &cpus[ncpu]; c++) {
+    rq = &c->mlfq;
+    acquire(&rq->lock);
+    for(lev = 0; lev < NMLFQ; lev++) {
+      for(idx = BEGIN(&rq->q[lev]); idx != END(&rq->q[lev]); idx = NEXT(idx)) {
+        if(rq->q[lev].items[idx] != p)
+          continue;
+        queue_remove_at(&rq->q[lev], idx);
+        if(queue_size(&rq->q[lev]) == 0)
+          rq->bitmap &= ~(1 << lev);
+        release(&rq->lock);
+        return;
+      }
+    }
+    release(&rq->lock);
+  }
+  // Not queued: a pick of p, if any, happened before we looked at
+  // its queue, so clearing the claim now cannot be undone by it
+  p->mlfq_claim = 0;
 }
 
+// The caller must hold rq->lock.
 int
-mlfq_pop(struct proc **item, int lev)
+mlfq_pop(struct mlfq_runq *rq, struct proc **item, int lev)
 {
-  if(lev < 0 && lev >= NMLFQ)
+  if(lev < 0 || lev >= NMLFQ)
     return -1;
-  *item = queue_front(&mlfq[lev]);
-  return queue_pop_item(&mlfq[lev]);
+  *item = queue_front(&rq->q[lev]);
+  if(queue_pop_item(&rq->q[lev]) < 0)
+    return -1;
+  if(queue_size(&rq->q[lev]) == 0)
+    rq->bitmap &= ~(1 << lev);
+  return 0;
 }
 
 int
-mlfq_empty(int lev)
+mlfq_empty(struct mlfq_runq *rq, int lev)
 {
-  return queue_size(&mlfq[lev]) == 0;
+  return queue_size(&rq->q[lev]) == 0;
 }
 
+// Move every process of rq to the top level if a boost happened
+// since rq was visited last time. The caller must hold rq->lock.
 static void
-mlfq_boost_priority(void)
+mlfq_boost_priority(struct mlfq_runq *rq)
 {
-  int lev;
+  int lev, idx, n;
   struct proc *p;
-  for(int idx = BEGIN(&mlfq[0]); idx != END(&mlfq[0]); idx = NEXT(idx))
-    mlfq[0].items[idx]->cticks = 0;
+
+  if(rq->epoch == mlfq_epoch)
+    return;
+  rq->epoch = mlfq_epoch;
+
+#if DEBUG_BOOSTING
+  cprintf("Priority Boosting Occurs\n");
+#endif
+  for(idx = BEGIN(&rq->q[0]); idx != END(&rq->q[0]); idx = NEXT(idx)) {
+    rq->q[0].items[idx]->cticks = 0;
+    rq->q[0].items[idx]->mlfq_epoch = rq->epoch;
+  }
   for(lev = NMLFQ - 1; lev > 0; lev--) {
-    while(queue_size(&mlfq[lev]) > 0) {
-      p = queue_front(&mlfq[lev]);
-      queue_pop_item(&mlfq[lev]);
+    for(n = queue_size(&rq->q[lev]); n > 0; n--) {
+      p = queue_front(&rq->q[lev]);
+      queue_pop_item(&rq->q[lev]);
+      if(!is_mlfq(p)) {
+        // A stride process under the MLFQ-only policy keeps its level
+        queue_push_item(&rq->q[lev], p);
+        continue;
+      }
       p->lev = 0;
       p->cticks = 0;
-      queue_push_item(&mlfq[0], p);
+      p->mlfq_epoch = rq->epoch;
+      queue_push_item(&rq->q[0], p);
     }
   }
+  rq->bitmap = 0;
+  for(lev = 0; lev < NMLFQ; lev++)
+    if(queue_size(&rq->q[lev]))
+      rq->bitmap |= 1 << lev;
 }
 
-static int
-mlfq_need_boosting(void)
+// Take the first process of the highest non-empty level of rq which
+// may run on cpu c, and claim it for c. The level is found with a bit
+// scan of the occupancy bitmap. Only rq->lock is held, not ptable.lock,
+// so the process is only checked under ptable.lock by mlfq_claimed().
+static struct proc *
+mlfq_pick(struct mlfq_runq *rq, struct cpu *c)
 {
-  int mlfq_has_to_boost = 0;
-  acquire(&mlfqlock); // Priority Boosting
-  mlfq_has_to_boost = mlfq_ticks >= MLFQ_BOOSTING_TICKS;
-  mlfq_ticks %= MLFQ_BOOSTING_TICKS;
-  release(&mlfqlock);
-  return mlfq_has_to_boost;
+  struct proc *p;
+  mlfq_queue_t *q;
+  uint bits, bit = 1 << (c - cpus);
+  int lev, idx;
+
+  acquire(&rq->lock);
+  mlfq_boost_priority(rq);
+  for(bits = rq->bitmap; bits; bits &= bits - 1) {
+    lev = __builtin_ctz(bits);
+    q = &rq->q[lev];
+    for(idx = BEGIN(q); idx != END(q); idx = NEXT(idx)) {
+      p = q->items[idx];
+      // Leave p to the cpus it may run on, which steal it from here
+      if((p->affinity & bit) == 0)
+        continue;
+      if(idx == BEGIN(q))
+        queue_pop_item(q);
+      else
+        queue_remove_at(q, idx);
+      if(queue_size(q) == 0)
+        rq->bitmap &= ~(1 << lev);
+      p->mlfq_claim = c;
+      release(&rq->lock);
+      return p;
+    }
+  }
+  release(&rq->lock);
+  return 0;
 }
 
-int
-mlfq_has_to_yield(struct proc *p)
+// Is p, picked by mlfq_pick(), still for cpu c to run? Between the pick
+// and now, mlfq_remove() or mlfq_reset() may have taken it back, or its
+// state and affinity may have changed. A process which has become
+// runnable elsewhere only is put back into the queues of that cpu.
+// The caller must hold ptable.lock.
+static int
+mlfq_claimed(struct proc *p, struct cpu *c)
 {
-  static int mlfq_ticks_elapsed;
-
-  const uint MLFQ_MAX_TICK_OF_CURRENT_PROC = MLFQ_MAX_TICKS[getlev()];
-
-  if(mlfq_ticks_elapsed >= MLFQ_MAX_TICK_OF_CURRENT_PROC) {
-    mlfq_ticks_elapsed = 0;
+  if(p->mlfq_claim != c)
+    return 0;
+  p->mlfq_claim = 0;
+  if(p->state != RUNNABLE || get_runnable_lwp(p, 0) == 0)
+    return 0; // A stale entry
+  if(!proc_allowed(p, c)) {
+    mlfq_push(p);
+    kick_idle_cpu(p);
+    return 0;
   }
-  mlfq_ticks_elapsed++; // Increase the time quantom for this queue
+  return 1;
+}
 
-  acquire(&mlfqlock);
-  mlfq_ticks += 1; // Increase the MLFQ tick count
-  release(&mlfqlock);
+// Steal the highest-priority runnable process from the other cpus.
+// Only one queue lock is held at a time.
+static struct proc *
+mlfq_steal(struct cpu *c)
+{
+  int i;
+  struct mlfq_runq *rq;
+  struct proc *p;
 
-  acquire(&ptable.lock);
-  p->cticks += 1; // Increase the process's tick count
-  if(mlfq_ticks_elapsed >= MLFQ_MAX_TICK_OF_CURRENT_PROC)
-    p->yield_by = 2;
-  release(&ptable.lock);
+  for(i = 1; i < ncpu; i++) {
+    rq = &cpus[(c - cpus + i) % ncpu].mlfq;
+    if(rq->bitmap && (p = mlfq_pick(rq, c)) != 0)
+      return p;
+  }
+  return 0;
+}
 
-  return mlfq_ticks_elapsed >= MLFQ_MAX_TICK_OF_CURRENT_PROC;
+// Called at trap with interrupts disabled.
+// Only touches the running process and this cpu, so no lock is needed.
+int
+mlfq_has_to_yield(struct proc *p)
+{
+  struct cpu *c = mycpu();
+
+  // Increase the MLFQ tick count;
+  // each run queue catches up with a boost on its next visit
+  if(__sync_add_and_fetch(&mlfq_ticks, 1) % MLFQ_BOOSTING_TICKS == 0)
+    __sync_fetch_and_add(&mlfq_epoch, 1);
+
+  // Increase the process's tick count; its lwps may tick on other cpus
+  __sync_fetch_and_add(&p->cticks, 1);
+  if(++c->mlfq_slice < MLFQ_MAX_TICKS[mlfq_level(p)])
+    return 0;
+  c->yield_by = 2;
+  return 1;
 }
 
 void
 mlfq_print(void)
 {
   int lev, idx;
+  struct cpu *c;
+  mlfq_queue_t *q;
   static const char *state2str[] = {
       [UNUSED] "unused",   [EMBRYO] "embryo",  [SLEEPING] "sleep ",
       [RUNNABLE] "runble", [RUNNING] "run   ", [ZOMBIE] "zombie"};
   cprintf("MLFQ Queue Info\n");
-  for(lev = 0; lev < NMLFQ; lev++) {
-    cprintf("Level %d (%d)\n", lev, queue_size(&mlfq[lev]));
-    cprintf("f=%d, r=%d\n", mlfq[lev].f, mlfq[lev].r);
-    for(idx = BEGIN(&mlfq[lev]); idx != END(&mlfq[lev]); idx = NEXT(idx))
-      cprintf("[%d] %s %s\n", idx, state2str[mlfq[lev].items[idx]->state],
-                   mlfq[lev].items[idx]->name);
-    cprintf("\n");
+  for(c = cpus; c < &cpus[ncpu]; c++) {
+    cprintf("CPU %d\n", c - cpus);
+    for(lev = 0; lev < NMLFQ; lev++) {
+      q = &c->mlfq.q[lev];
+      cprintf("Level %d (%d)\n", lev, queue_size(q));
+      cprintf("f=%d, r=%d\n", q->f, q->r);
+      for(idx = BEGIN(q); idx != END(q); idx = NEXT(idx))
+        cprintf("[%d] %s %s\n", idx, state2str[q->items[idx]->state],
+                q->items[idx]->name);
+      cprintf("\n");
+    }
   }
 }
 
@@ -177,35 +365,34 @@ is_mlfq(struct proc *p)
   return p && p->lev >= 0 && p->lev < NMLFQ;
 }
 
+// Run MLFQ processes on cpu c until none is runnable here.
+// Called with ptable.lock held, which is dropped while the queues are
+// scanned: a process is owned by its queue until mlfq_pick() claims it
+// for this cpu, and mlfq_claimed() then checks the claim under the lock.
 void
 mlfq_scheduler(struct cpu *c)
 {
-  int lev, idx, begin, end;
   struct proc *p;
+  uint start, gen = sched_gen;
 
   while(1) {
-    for(lev = 0; lev < NMLFQ; lev++) {
-      begin = BEGIN(&mlfq[lev]), end = END(&mlfq[lev]);
-      for(idx = begin; idx != end; idx = NEXT(idx)) {
-        mlfq_pop(&p, lev);
-        if(p->state == RUNNABLE) {
-          goto mlfq_found;
-        }
-        mlfq_push(p);
-      }
+    // Prefer the local queues, then steal from busy cpus
+    release(&ptable.lock);
+    start = rdtsc();
+    if((p = mlfq_pick(&c->mlfq, c)) == 0)
+      p = mlfq_steal(c);
+    if(p) {
+      c->mlfq_pick_cycles += (uint)rdtsc() - start;
+      c->mlfq_npick++;
     }
-    return; // No runnable items found
-
-  mlfq_found:
-    // Switch to chosen process.  It is the process's job
-    // to release ptable.lock and then reacquire it
-    // before jumping back to us.
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
+    acquire(&ptable.lock);
+    if(p == 0 || gen != sched_gen)
+      return; // No runnable items found, or the queues were rebuilt
+    if(!mlfq_claimed(p, c))
+      continue;
 
-    swtch(&(c->scheduler), mylwp(p)->context);
-    switchkvm();
+    c->mlfq_slice = 0;
+    sched_run(c, p);
 
     if(is_mlfq(p)) {
       if(p->cticks >=
@@ -213,28 +400,17 @@ mlfq_scheduler(struct cpu *c)
         p->cticks = 0;               // Reset the tick counts
         p->lev = GET_MIN(p->lev + 1, NMLFQ - 1); // Lower the priority level
       }
-
-      if(p->state != ZOMBIE) {
-        // Push a non-zombie process into MLFQ
-        mlfq_push(p);
-      }
-
-      if(mlfq_need_boosting()) {
-#if DEBUG_BOOSTING
-        cprintf("Priority Boosting Occurs\n");
-#endif
-        mlfq_boost_priority();
-      }
     }
 
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+    // Requeue a preempted process on this cpu; sleeping ones
+    // are pushed again by setrunnable() when they wake up
+    sched_settle(p);
 
-    if(p->yield_by == 1) { // yield by stride
-      p->yield_by = 0;
+    // Return on a yield by stride or when the policy has been switched
+    if(c->yield_by == 1 || gen != sched_gen) {
+      c->yield_by = 0;
       return;
     }
-    p->yield_by = 0;
+    c->yield_by = 0;
   }
-}
\ No newline at end of file
+}
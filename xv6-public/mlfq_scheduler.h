@@ -9,7 +9,6 @@
 #include "proc.h"
 #include "spinlock.h"
 
-#define NMLFQ 3
 #define DEBUG_BOOSTING 0
 static const uint MLFQ_BOOSTING_TICKS = 200;
 static const uint MLFQ_MAX_TICKS[NMLFQ] = {5, 10, 20};
@@ -17,11 +16,15 @@ static const uint MLFQ_TIME_ALLOTS[NMLFQ] = {20, 40, 1 << 31};
 
 typedef struct proc_queue mlfq_queue_t;
 extern uint mlfq_ticks;
+extern uint mlfq_epoch;
 
 int is_mlfq(struct proc *p);
+void mlfq_init(void);
+void mlfq_reset(void);
 int mlfq_push(struct proc *item);
-int mlfq_pop(struct proc **item, int lev);
-int mlfq_empty(int lev);
+void mlfq_remove(struct proc *p);
+int mlfq_pop(struct mlfq_runq *rq, struct proc **item, int lev);
+int mlfq_empty(struct mlfq_runq *rq, int lev);
 void mlfq_scheduler(struct cpu *c);
 void mlfq_print(void);
 int mlfq_has_to_yield(struct proc *p);
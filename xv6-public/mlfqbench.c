@@ -0,0 +1,76 @@
+/**
+ * This program measures how long the MLFQ scheduler takes to pick the next
+ * process when most processes are asleep. NSLEEPERS processes wake up
+ * every tick and go back to sleep right away, while NSPINNERS processes
+ * keep the cpus busy. The kernel times every pick with the TSC and the
+ * average over the measurement window is reported through getkstat().
+ *
+ * NPROC is 64, so init, sh and this program leave room for 56 sleepers.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define NSLEEPERS 56
+#define NSPINNERS 4
+#define WARMUP 50
+#define DURATION 500
+
+static int pids[NSLEEPERS + NSPINNERS];
+
+static void
+sleeper(void)
+{
+  for(;;)
+    sleep(1);
+}
+
+static void
+spinner(void)
+{
+  volatile int x = 0;
+  for(;;)
+    x++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  int i, n = 0;
+  uint picks, cycles;
+
+  for(i = 0; i < NSLEEPERS + NSPINNERS; i++) {
+    if((pids[i] = fork()) < 0) {
+      printf(1, "fork failed after %d children\n", i);
+      break;
+    }
+    if(pids[i] == 0) {
+      if(i < NSLEEPERS)
+        sleeper();
+      else
+        spinner();
+    }
+    n++;
+  }
+
+  sleep(WARMUP);
+  getkstat(&before);
+  sleep(DURATION);
+  getkstat(&after);
+
+  for(i = 0; i < n; i++)
+    kill(pids[i]);
+  for(i = 0; i < n; i++)
+    wait();
+
+  picks = after.mlfq_npick - before.mlfq_npick;
+  cycles = after.mlfq_pick_cycles - before.mlfq_pick_cycles;
+  printf(1, "%d sleepers, %d spinners, %d cpus, %d ticks\n", NSLEEPERS,
+         NSPINNERS, after.ncpu, after.ticks - before.ticks);
+  printf(1, "%d picks, %d cycles per pick\n", picks,
+         picks ? cycles / picks : 0);
+  exit();
+}
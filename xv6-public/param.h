@@ -3,8 +3,9 @@
 #define NLWPS        64  // maximum number of light-weight processes
 #define KSTACKSIZE 4096  // size of per-lwp kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NMCSNODE      4  // MCS locks a CPU can hold or wait for at once
+#define KMAXORDER    10  // largest kalloc_pages() block is 2^KMAXORDER pages
 #define NOFILE      256  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -14,5 +15,4 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       40000  // size of file system in blocks
 #define USERTOP      0x7fffe000 // top of user stack
-#define NPAGESPERLWP 6 // maximum number of pages that a lwp can use
-#define MAX_LWPS (NLWPS * NLWPS) // maximum number of lwps in a system
\ No newline at end of file
+#define NPAGESPERLWP 6 // maximum number of pages that a lwp can use
\ No newline at end of file
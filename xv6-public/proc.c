@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
 #include "schedulers.h"
 
 struct {
@@ -20,11 +21,14 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void setrunnable(struct proc *p);
 
 void
 pinit(void)
 {
-  initlock(&ptable.lock, "ptable");
+  initlock_kind(&ptable.lock, "ptable", SPIN_MCS);
+  mlfq_init();
+  stride_init();
 }
 
 // Must be called with interrupts disabled
@@ -33,19 +37,16 @@ cpuid() {
   return mycpu()-cpus;
 }
 
-// Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// Find the cpu we run on by its local APIC ID. Only seginit() needs
+// this; everything else reads mycpu() through %gs.
+// Must be called with interrupts disabled.
 struct cpu*
-mycpu(void)
+lapiccpu(void)
 {
   int apicid, i;
-  
-  if(readeflags()&FL_IF)
-    panic("mycpu called with interrupts enabled\n");
-  
+
   apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
+  // APIC IDs are not guaranteed to be contiguous.
   for (i = 0; i < ncpu; ++i) {
     if (cpus[i].apicid == apicid)
       return &cpus[i];
@@ -53,19 +54,6 @@ mycpu(void)
   panic("unknown apicid\n");
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
-struct proc*
-myproc(void) {
-  struct cpu *c;
-  struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
-  return p;
-}
-
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -90,17 +78,24 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->affinity = ~0;
+  p->mlfq_claim = 0;
 
   release(&ptable.lock);
 
   initsleeplock(&p->lock, 0);
 
   p->lwp_idx = 0;
-  lwp = p->lwps[p->lwp_idx] = alloclwp();
+  if((lwp = p->lwps[p->lwp_idx] = alloclwp()) == 0){
+    p->state = UNUSED;
+    return 0;
+  }
   lwp->tid = p->lwp_cnt++;
 
   // Allocate kernel stack.
   if((lwp->kstack = kalloc()) == 0){
+    dealloclwp(lwp);
+    p->lwps[p->lwp_idx] = 0;
     p->state = UNUSED;
     return 0;
   }
@@ -139,7 +134,7 @@ userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
-  lwp = mylwp(p);
+  lwp = p->lwps[0];
   memset(lwp->tf, 0, sizeof(*lwp->tf));
   lwp->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   lwp->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -152,10 +147,9 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
+  // By default, run it under the MLFQ
   p->lev = 0;
   p->cticks = 0;
-  // By default, push it to MLFQ
-  mlfq_push(p);
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
@@ -163,8 +157,8 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
   lwp->state = LWP_RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
@@ -187,8 +181,10 @@ growproc(int n)
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    // Unmap, flush the other cpus, and only then free the pages
+    sz = unmapuvm(curproc->pgdir, sz, sz + n);
+    tlbshootdown(curproc);
+    freeuvm(curproc->pgdir, curproc->sz, sz);
   }
   curproc->sz = sz;
   switchuvm(curproc);
@@ -227,10 +223,15 @@ fork(void)
         if((np->lwps[i]->kstack = kalloc()) == 0){
           panic("cannot allocate kstack");
         }
+        // copy_lwp() copies the trap frame into its own kernel stack
+        np->lwps[i]->tf = (struct trapframe*)
+          (np->lwps[i]->kstack + KSTACKSIZE - sizeof(struct trapframe));
       }
 
-      // Copy lwp content
+      // Copy lwp content. Only the main lwp has a kernel context
+      // to start from, so the copies can only be joined.
       copy_lwp(np->lwps[i], curproc->lwps[i]);
+      np->lwps[i]->state = LWP_ZOMBIE;
     }
   }
 
@@ -246,8 +247,6 @@ fork(void)
       }
     }
     
-    // Remove Code + Data/BSS + Heap
-    deallocuvm(curproc->pgdir, curproc->sz, 0);
     np->state = UNUSED;
 
     kprintf_info("Fail to fork bcuz fail to copy uvm\n");
@@ -255,11 +254,16 @@ fork(void)
     return -1;
   }
 
+  // The memory of the parent is read-only now until written to
+  lcr3(V2P(curproc->pgdir));
+  tlbshootdown(curproc);
+
   np->sz = curproc->sz;
   np->parent = curproc;
+  np->affinity = curproc->affinity;
 
   // Clear %eax so that fork returns 0 in the child.
-  np->lwps[curproc->lwp_idx]->tf->eax = 0;
+  np->lwps[mylwp1(curproc) - curproc->lwps]->tf->eax = 0;
 
   // Copy file descripters
   for(i = 0; i < NOFILE; i++)
@@ -273,18 +277,17 @@ fork(void)
 
   pid = np->pid;
 
+  // By default, run it under the MLFQ
   np->lev = 0;
   np->cticks = 0;
-  // By default, push it to MLFQ
-  mlfq_push(np);
 
   kprintf_info("fork() %d\n", pid);
   releasesleep(&curproc->lock);
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
-  mylwp(np)->state = LWP_RUNNABLE;
+  np->lwps[0]->state = LWP_RUNNABLE;
+  setrunnable(np);
 
   release(&ptable.lock);
   return pid;
@@ -303,6 +306,14 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // Only one lwp tears the process down; the others retire here
+  if(stop_other_lwps() < 0){
+    acquire(&ptable.lock);
+    (*mylwp1(curproc))->state = LWP_ZOMBIE;
+    sched();
+    panic("zombie lwp");
+  }
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -331,6 +342,8 @@ exit(void)
   }
 
   // Jump into the scheduler, never to return.
+  if(is_stride(curproc))
+    stride_leave(curproc);
   curproc->state = ZOMBIE;
   for(struct lwp** p_lwp = curproc->lwps; p_lwp < &curproc->lwps[NLWPS]; ++p_lwp){
     if(*p_lwp){
@@ -342,6 +355,108 @@ exit(void)
   panic("zombie exit");
 }
 
+// Stop every other lwp of the current process before exit() or exec()
+// tears it down or replaces its image. They are treated as killed until
+// all of them have retired: sleeping ones are woken up, running ones are
+// kicked into the kernel, and each retires when it would return to user
+// space (see trap), so that none is stopped in the middle of a system call.
+// Returns -1 without stopping anything if another lwp is already doing
+// it; the caller must then retire as well.
+int
+stop_other_lwps(void)
+{
+  struct proc *p = myproc();
+  struct lwp **self = mylwp1(p), **l;
+  struct cpu *c;
+  int killed, others;
+
+  acquire(&ptable.lock);
+  if(p->lwp_reaper && p->lwp_reaper != *self){
+    release(&ptable.lock);
+    return -1;
+  }
+  p->lwp_reaper = *self;
+  killed = p->killed;
+  p->killed = 1;
+
+  for(;;){
+    // An lwp may go back to sleep without checking killed, so wake
+    // the sleeping ones again on every round
+    others = 0;
+    for(l = p->lwps; l < &p->lwps[NLWPS]; l++){
+      if(*l == 0 || l == self || (*l)->state == LWP_ZOMBIE)
+        continue;
+      others = 1;
+      if((*l)->state == LWP_SLEEPING)
+        wakeup_lwp(p, *l);
+    }
+    if(!others)
+      break;
+    for(c = cpus; c < &cpus[ncpu]; c++)
+      if(c->proc == p && c->lwp != self)
+        lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+    sleep(p, &ptable.lock);  // See sched_settle()
+  }
+  p->killed = killed;
+
+  // Nothing else of p is left to run
+  if(p->state == RUNNABLE){
+    mlfq_remove(p);
+    p->state = RUNNING;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Part of the address space of the current process p was unmapped
+// or remapped: make the other cpus running lwps of p drop their stale
+// TLB entries, and wait until they did so that the freed pages can be
+// reused. The caller may hold spin locks: a cpu spinning with
+// interrupts off answers the request from its spin loop instead.
+void
+tlbshootdown(struct proc *p)
+{
+  struct cpu *c;
+  uint sent[NCPU], ntlb[NCPU], nswtch[NCPU];
+  int i;
+
+  pushcli();
+  for(i = 0; i < ncpu; i++){
+    c = &cpus[i];
+    ntlb[i] = c->ntlb;
+    nswtch[i] = c->nswtch;
+    sent[i] = c != mycpu() && c->proc == p;
+    if(sent[i]){
+      c->tlbreq = 1;
+      lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    }
+  }
+  popcli();
+
+  // Switching to another lwp reloads %cr3 as well
+  for(i = 0; i < ncpu; i++){
+    c = &cpus[i];
+    while(sent[i] && c->proc == p && c->ntlb == ntlb[i] &&
+          c->nswtch == nswtch[i]){
+      // With interrupts off, as in a page fault, answer a shootdown
+      // which that cpu may be waiting for from this one meanwhile
+      if(!(readeflags() & FL_IF) && mycpu()->tlbreq)
+        tlbflush(mycpu());
+      pause();
+    }
+  }
+}
+
+// Drop the TLB entries of cpu c, the current one, as another cpu
+// asked by tlbshootdown().
+void
+tlbflush(struct cpu *c)
+{
+  c->tlbreq = 0;
+  lcr3(rcr3());
+  c->ntlb++;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
@@ -382,6 +497,7 @@ wait(void)
         p->state = UNUSED;
         p->lwp_idx = 0;
         p->lwp_cnt = 0;
+        p->lwp_reaper = 0;
         release(&ptable.lock);
         // kprintf_info("return wait()\n");
         releasesleep(&curproc->lock);
@@ -403,6 +519,226 @@ wait(void)
   }
 }
 
+// Can lwp of process p run on cpu c? Both masks must allow c.
+int
+lwp_allowed(struct proc *p, struct lwp *lwp, struct cpu *c)
+{
+  uint bit = 1 << (c - cpus);
+
+  return (p->affinity & bit) && (lwp->affinity & bit);
+}
+
+// Can cpu c run p, that is, one of its runnable lwps?
+int
+proc_allowed(struct proc *p, struct cpu *c)
+{
+  return get_runnable_lwp(p, c) != 0;
+}
+
+// Is there any process that cpu c could run?
+// The ptable lock must be held.
+static int
+have_runnable(struct cpu *c)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state == RUNNABLE && proc_allowed(p, c))
+      return 1;
+  return 0;
+}
+
+// Halt until the next interrupt unless a wakeup came in
+// since c->idle was set. sti takes effect only after the next
+// instruction, so an IPI pending at this point still wakes the hlt.
+static void
+idle(struct cpu *c)
+{
+  cli();
+  if(c->idle){
+    c->nhalt++;
+    asm volatile("sti; hlt");
+  }
+  c->idle = 0;
+}
+
+// p has become runnable: kick one halted cpu which may run it, if any,
+// so that it does not sleep until its next timer interrupt.
+// The ptable lock must be held.
+void
+kick_idle_cpu(struct proc *p)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(!c->idle || !proc_allowed(p, c))
+      continue;
+    c->idle = 0;
+    // The current cpu is only idle when we run in an interrupt
+    // that already woke it from hlt.
+    if(c != mycpu())
+      lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+    return;
+  }
+}
+
+static void
+stride_enqueue(struct proc *p)
+{
+  if(is_stride(p))
+    stride_wakeup(p);
+  else
+    mlfq_push(p);
+}
+
+static int
+stride_policy_has_to_yield(struct proc *p)
+{
+  // The MLFQ item also runs for one stride quantum at a time
+  return stride_has_to_yield(p) || (is_mlfq(p) && mlfq_has_to_yield(p));
+}
+
+static void
+mlfq_enqueue(struct proc *p)
+{
+  mlfq_push(p);
+}
+
+static void
+rr_enqueue(struct proc *p)
+{
+  // rr_scheduler() scans the process table
+}
+
+static int
+rr_has_to_yield(struct proc *p)
+{
+  return 1;
+}
+
+static const struct sched_ops sched_ops[NSCHED] = {
+  [SCHED_STRIDE] {"stride", stride_scheduler, stride_enqueue,
+                  stride_policy_has_to_yield},
+  [SCHED_MLFQ]   {"mlfq", mlfq_scheduler, mlfq_enqueue, mlfq_has_to_yield},
+  [SCHED_RR]     {"rr", rr_scheduler, rr_enqueue, rr_has_to_yield},
+};
+
+int sched_policy = SCHED_DEFAULT;
+uint sched_gen;
+
+// Make a new or sleeping process runnable: put it into the run queue
+// of the current policy and wake up an idle cpu to run it.
+// A preempted process is put back by its scheduler instead.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  sched_ops[sched_policy].enqueue(p);
+  kick_idle_cpu(p);
+}
+
+// Run a runnable lwp of p on cpu c until it gives the cpu back.
+// p stays RUNNABLE, and queued, while it has other runnable lwps so
+// that idle cpus can run them at the same time; otherwise it is RUNNING.
+// The ptable lock must be held.
+void
+sched_run(struct cpu *c, struct proc *p)
+{
+  struct lwp **slot;
+
+  if((slot = get_runnable_lwp(p, c)) == 0)
+    panic("sched_run");
+  p->lwp_idx = slot - p->lwps;
+  (*slot)->state = LWP_RUNNING;
+  if(get_runnable_lwp(p, 0))
+    setrunnable(p);
+  else
+    p->state = RUNNING;
+
+  // Switch to chosen lwp.  It is the lwp's job
+  // to release ptable.lock and then reacquire it
+  // before jumping back to us.
+  c->proc = p;
+  c->lwp = slot;
+  switchuvm(p);
+  c->nswtch++;
+
+  swtch(&(c->scheduler), (*slot)->context);
+  switchkvm();
+
+  // The lwp is done running for now.
+  // It should have changed its state before coming back.
+  c->proc = 0;
+  c->lwp = 0;
+}
+
+// An lwp of p has given the cpu back: derive p->state from its lwps
+// and put p back into the run queue if it has become runnable.
+// A RUNNABLE process is still queued, or picked by another cpu
+// which is about to run it. The ptable lock must be held.
+void
+sched_settle(struct proc *p)
+{
+  struct lwp **l;
+
+  if(p->state != RUNNABLE && p->state != ZOMBIE){
+    p->state = SLEEPING;
+    for(l = p->lwps; l < &p->lwps[NLWPS]; l++)
+      if(*l && (*l)->state == LWP_RUNNING)
+        p->state = RUNNING;
+    if(get_runnable_lwp(p, 0)){
+      p->state = RUNNABLE;
+      sched_ops[sched_policy].enqueue(p);
+    }
+  }
+
+  // stop_other_lwps() waits for the lwps to leave their cpus
+  if(p->lwp_reaper)
+    wakeup1(p);
+}
+
+// Called at trap with interrupts disabled.
+int
+sched_has_to_yield(struct proc *p)
+{
+  return sched_ops[sched_policy].has_to_yield(p);
+}
+
+// Switch the scheduling policy. The queues of the new policy are rebuilt
+// from the process table. Running processes are left out: bumping
+// sched_gen tells the scheduler which runs them to requeue them with
+// sched_settle() when they come back, instead of doing the bookkeeping
+// of the old policy. Returns the previous policy.
+int
+sched_switch(int policy)
+{
+  struct proc *p;
+  int old;
+
+  if(policy < 0 || policy >= NSCHED)
+    return -1;
+
+  acquire(&ptable.lock);
+  old = sched_policy;
+  if(policy != old) {
+    sched_policy = policy;
+    sched_gen++;
+    mlfq_reset();
+    stride_reset();
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+      p->stride_idx = 0;
+      p->stride_pass = 0; // Restart from the global pass
+      if(p->state == RUNNABLE)
+        sched_ops[policy].enqueue(p);
+    }
+    cprintf("scheduler: %s -> %s\n", sched_ops[old].name,
+            sched_ops[policy].name);
+  }
+  release(&ptable.lock);
+  return old;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -414,17 +750,8 @@ wait(void)
 void
 scheduler(void)
 {
-  // Setting for Stride Queue
-  {
-    // Initialize the stride queue
-    stride_init();
-    // Push MLFQ Item
-    StrideItem mlfq_item;
-    stride_item_init(&mlfq_item, STRIDE_MLFQ_SHARE, 0, 1);
-    stride_push(&mlfq_item);
-  }
-  
   struct cpu *c = mycpu();
+  uint nswtch;
   c->proc = 0;
   
   for(;;){
@@ -433,11 +760,22 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    // mlfq_scheduler(c); // Use a mlfq scheduler
-    stride_scheduler(c); // Use a stride scheduler
-    // rr_scheduler(c); // Use a xv6 default RR scheduler
+    nswtch = c->nswtch;
+    sched_ops[sched_policy].schedule(c);
+
+    // Nothing ran and nothing can run: go idle.
+    // wakeup1() clears c->idle under ptable.lock before kicking us.
+    if(c->nswtch == nswtch && !have_runnable(c))
+      c->idle = 1;
     release(&ptable.lock);
 
+    // Rather than halt, zero a free page while the pool runs low
+    if(c->idle){
+      if(kzero_idle())
+        c->idle = 0;
+      else
+        idle(c);
+    }
   }
 }
 
@@ -473,9 +811,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  struct proc* p = myproc();
-  p->state = RUNNABLE;
-  mylwp(p)->state = LWP_RUNNABLE;
+  mylwp(myproc())->state = LWP_RUNNABLE;
   sched();
   release(&ptable.lock);
 }
@@ -486,8 +822,7 @@ yield1(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
   struct proc* p = myproc();
-  p->cticks += 1;  // for preventing to game the scheduler
-  p->state = RUNNABLE;
+  __sync_fetch_and_add(&p->cticks, 1);  // for preventing to game the scheduler
   mylwp(p)->state = LWP_RUNNABLE;
   sched();
   release(&ptable.lock);
@@ -542,24 +877,16 @@ sleep(void *chan, struct spinlock *lk)
     release(lk);
   }
 
-  // Sleep the current lwp
+  // Sleep the current lwp; the other lwps of p keep running.
   // Go to sleep.
   lwp->chan = chan;
   lwp->state = LWP_SLEEPING;
+  waitq_insert(p, lwp);
 
-  struct lwp **p_next_lwp = get_runnable_lwp(p);
-  if(p_next_lwp != 0 && p_next_lwp != mylwp1(p)) {
-    // If another lwp is runnable, switch to antoher lwp.
-    kprintf_info("switch to next runnable lwp\n");
-    swtchlwp1(p_next_lwp);
-  } else {
-    // Otherwise, swith to the kernel scheduler.
-    kprintf_info("switch to kscheduler\n");
-    
-    p->state = SLEEPING;
-    sched();
-    kprintf_info("switched back from kscheduler\n");
-  }
+  sched();
+
+  // kill() and exit() wake lwps without going through the wait channel
+  waitq_remove(lwp);
 
   // Tidy up.
   lwp->chan = 0;
@@ -577,19 +904,18 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-  struct lwp** lwp;
+  waitq_wakeup(chan);
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    for(lwp = p->lwps; lwp < &p->lwps[NLWPS]; ++lwp){
-      if((*lwp) && (*lwp)->state == LWP_SLEEPING && (*lwp)->chan == chan){
-        if(p->state == SLEEPING){
-          p->state = RUNNABLE;
-        }
-        (*lwp)->state = LWP_RUNNABLE;
-      }
-    }
-  }
+// Make a sleeping or new lwp of p runnable. p becomes runnable too
+// unless it already is, even if its other lwps are running.
+// The ptable lock must be held.
+void
+wakeup_lwp(struct proc *p, struct lwp *lwp)
+{
+  lwp->state = LWP_RUNNABLE;
+  if(p->state == SLEEPING || p->state == RUNNING)
+    setrunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
@@ -608,15 +934,16 @@ int
 kill(int pid)
 {
   struct proc *p;
+  struct lwp **l;
 
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
       p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING){
-        p->state = RUNNABLE;
-      }
+      // Wake its lwps from sleep if necessary.
+      for(l = p->lwps; l < &p->lwps[NLWPS]; l++)
+        if(*l && (*l)->state == LWP_SLEEPING)
+          wakeup_lwp(p, *l);
       release(&ptable.lock);
       return 0;
     }
@@ -644,6 +971,7 @@ procdump(void)
   struct proc *p;
   char *state;
   uint pc[10];
+  struct lwp *lwp;
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->state == UNUSED)
@@ -653,8 +981,9 @@ procdump(void)
     else
       state = "???";
     cprintf("%d %s %s", p->pid, state, p->name);
-    if(mylwp(p)->state == LWP_SLEEPING){
-      getcallerpcs((uint*)mylwp(p)->context->ebp+2, pc);
+    lwp = p->lwps[p->lwp_idx];
+    if(lwp && lwp->state == LWP_SLEEPING){
+      getcallerpcs((uint*)lwp->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
         cprintf(" %p", pc[i]);
     }
@@ -2,9 +2,11 @@
 #include "lwp.h"
 #include "defs.h"
 #include "sleeplock.h"
+#include "mlfq_queue.h"
 
 // Per-CPU state
 struct cpu {
+  struct cpu *self;            // This struct, read as %gs:0 by mycpu()
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
   struct taskstate ts;         // Used by x86 to find stack for interrupt
@@ -13,6 +15,21 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct lwp **lwp;            // Slot of the lwp running on this cpu or null
+  struct mlfq_runq mlfq;       // MLFQ level queues owned by this cpu
+  uint stride_slice;           // Ticks used in the current stride time slice
+  uint mlfq_slice;             // Ticks used in the current MLFQ time slice
+  uint yield_by;               // The running lwp yields by stride = 1, mlfq = 2
+  volatile uint idle;          // Halted in scheduler; wake up with an IPI
+  uint nswtch;                 // Number of switches into a process
+  uint nhalt;                  // Number of times the idle cpu halted
+  uint nipi;                   // Number of reschedule IPIs received
+  volatile uint tlbreq;        // Another cpu waits for this one to flush its TLB
+  uint ntlb;                   // Number of TLB flushes asked by other cpus
+  uint mlfq_npick;             // Number of processes picked by the MLFQ
+  uint mlfq_pick_cycles;       // TSC cycles spent picking them (wraps)
+  struct mcs_node mcs[NMCSNODE]; // Nodes for the MCS locks taken here
+  uint mcs_used;               // Bitmap of the nodes in use
 };
 
 extern struct cpu cpus[NCPU];
@@ -51,27 +68,58 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint cticks;                 // Consumed tick count at the given level of the queue
-  uint yield_by :  4;          // the process is yield by stride = 1, mlfq = 2
-  uint lev      : 28;          // Level in MLFQ(0~NMLFQ), otherwise Stride Level
-  int lwp_idx;                 // Current LWP index
+  uint lev;                    // Level in MLFQ(0~NMLFQ), otherwise Stride Level
+  uint mlfq_epoch;             // Last priority boost seen by the process
+  struct cpu *mlfq_claim;      // Cpu which took it out of an MLFQ queue to run it
+  uint stride_idx;             // Slot in the stride heap, 0 if none
+  uint stride_share;           // Share reserved in the stride queue
+  unsigned long long stride_pass; // Pass (plus base_pass) saved at sleep
+  uint affinity;               // Mask of cpus the process may run on
+  int lwp_idx;                 // Index of the LWP dispatched last
   struct lwp *lwps[NLWPS];     // LWPs
   int lwp_cnt;                 // LWP counter
+  struct lwp *lwp_reaper;      // LWP stopping the others in exit or exec
   struct sleeplock lock;       // Lock object for exec
 };
 
-inline struct lwp**
+// seginit() points the base of %gs at the struct cpu of each cpu, so
+// the fields of the current cpu are a single load away. A single load
+// cannot be split by an interrupt, so reading the running process or
+// lwp needs no pushcli(); the cpu itself may change right after unless
+// interrupts are off.
+#define CPU_FIELD(type, field) ({                            \
+  type __v;                                                 \
+  asm volatile("movl %%gs:%c1, %0" : "=r" (__v)             \
+               : "i" (__builtin_offsetof(struct cpu, field))); \
+  __v;                                                      \
+})
+
+static inline struct cpu*
+mycpu(void)
+{
+  return CPU_FIELD(struct cpu*, self);
+}
+
+static inline struct proc*
+myproc(void)
+{
+  return CPU_FIELD(struct proc*, proc);
+}
+
+// Slot of the lwp of the current process p running on this cpu
+static inline struct lwp**
 mylwp1(struct proc* p)
 {
-  return &p->lwps[p->lwp_idx];
+  return CPU_FIELD(struct lwp**, lwp);
 }
 
-inline struct lwp*
+static inline struct lwp*
 mylwp(struct proc* p)
 {
   return *mylwp1(p);
 }
 
-inline uint
+static inline uint
 stack_base_lwp(struct lwp **p_lwp)
 {
   if(p_lwp == 0)
@@ -79,14 +127,14 @@ stack_base_lwp(struct lwp **p_lwp)
   return USERTOP - (p_lwp - myproc()->lwps) * NPAGESPERLWP * PGSIZE;
 }
 
-inline uint
+static inline uint
 stack_top_lwp(struct lwp **p_lwp)
 {
   uint base = stack_base_lwp(p_lwp);
   return base - (*p_lwp)->stack_sz;
 }
 
-inline uint
+static inline uint
 is_stack_addr(uint addr)
 {
   struct proc* curproc = myproc();
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "schedulers.h"
 
 extern struct {
   struct spinlock lock;
@@ -14,22 +15,17 @@ extern struct {
 
 void rr_scheduler(struct cpu *c) {
   struct proc *p;
+  uint gen = sched_gen;
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if (p->state != RUNNABLE)
+    if (p->state != RUNNABLE || !proc_allowed(p, c))
       continue;
 
-    // Switch to chosen process.  It is the process's job
-    // to release ptable.lock and then reacquire it
-    // before jumping back to us.
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
+    // Run one lwp of p until it gives the cpu back
+    sched_run(c, p);
+    sched_settle(p);
 
-    swtch(&(c->scheduler), mylwp(p)->context);
-    switchkvm();
-
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+    // Another policy took over while p was running
+    if (gen != sched_gen)
+      return;
   }
 }
\ No newline at end of file
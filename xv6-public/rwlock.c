@@ -10,72 +10,191 @@
 #include "spinlock.h"
 #include "rwlock.h"
 
-extern void xem_init(xem_t *semaphore, int cap);
-extern void xem_wait(xem_t *semaphore);
-extern void xem_unlock(xem_t *semaphore);
+// Waiters queue in FIFO order on the futex table, readers on the address
+// of wait_readers and writers on that of wait_writers. Whoever releases
+// the lock picks the next owners according to the mode, takes the lock on
+// their behalf and wakes exactly them: one writer, or every queued reader
+// at once. A woken lwp therefore already holds the lock.
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+#define READERS_KEY(rw) ((uint)&(rw)->wait_readers)
+#define WRITERS_KEY(rw) ((uint)&(rw)->wait_writers)
+
+// Whether a new reader may join the current readers right away
+static int
+may_read(rwlock_t *rwlock)
+{
+  if(rwlock->writer)
+    return 0;
+  return rwlock->mode == RWLOCK_PREFER_READER || rwlock->wait_writers == 0;
+}
 
-void
-rwlock_init(rwlock_t *rwlock)
+// Hand the lock to every queued reader. Returns the number admitted.
+static int
+admit_readers(rwlock_t *rwlock)
 {
-  rwlock->num_readers = 0;
-  rwlock->num_writers = 0;
-  initlock(&rwlock->lk, "rwlock");
-  xem_init(&rwlock->write, 1);
+  int n;
+
+  if(rwlock->wait_readers == 0)
+    return 0;
+  n = futex_wake(myproc()->pgdir, READERS_KEY(rwlock), rwlock->wait_readers);
+  rwlock->wait_readers -= n;
+  rwlock->num_readers += n;
+  return n;
 }
 
-void
-rwlock_acquire_readlock(rwlock_t *rwlock)
+// Hand the lock to the oldest queued writer. Returns 1 if there was one.
+static int
+admit_writer(rwlock_t *rwlock)
 {
-  int num_readers;
+  if(rwlock->wait_writers == 0 ||
+     futex_wake(myproc()->pgdir, WRITERS_KEY(rwlock), 1) == 0)
+    return 0;
+  rwlock->wait_writers--;
+  rwlock->writer = 1;
+  return 1;
+}
+
+// Let in the waiters which may enter now. after_write tells whether a
+// writer has just left, which starts a read phase in the phase-fair mode.
+// The caller must hold rwlock->lk.
+static void
+pass_on(rwlock_t *rwlock, int after_write)
+{
+  int readers_first;
+
+  if(rwlock->writer)
+    return;
+  if(rwlock->num_readers > 0) {
+    if(may_read(rwlock))
+      admit_readers(rwlock);
+    return;
+  }
+  if(rwlock->mode == RWLOCK_PREFER_READER)
+    readers_first = 1;
+  else if(rwlock->mode == RWLOCK_PREFER_WRITER)
+    readers_first = 0;
+  else
+    readers_first = after_write;
+  if(readers_first && admit_readers(rwlock))
+    return;
+  if(admit_writer(rwlock))
+    return;
+  admit_readers(rwlock);
+}
+
+// Queue the current lwp on key and sleep until the lock is handed over.
+// Returns -1 without the lock if the process was killed meanwhile.
+// The caller must hold rwlock->lk, which is released.
+static int
+wait_handoff(rwlock_t *rwlock, uint *waiting, uint key)
+{
+  struct proc *p = myproc();
+  int ret;
+
+  ++*waiting;
+  // Queue before dropping lk so a release cannot miss us
+  acquire(&ptable.lock);
+  futex_enqueue(p, p->pgdir, key);
+  release(&rwlock->lk);
+  ret = futex_sleep(p);
+  release(&ptable.lock);
+  if(ret == 0)
+    return 0;
 
+  // Not handed over; others may have been held back by us
   acquire(&rwlock->lk);
-  while(rwlock->num_writers > 0)
-    sleep(rwlock, &rwlock->lk);
-  num_readers = ++rwlock->num_readers;
-  if(num_readers == 1)
-    xem_wait(&rwlock->write);
+  --*waiting;
+  pass_on(rwlock, 0);
   release(&rwlock->lk);
+  return -1;
 }
 
 void
-rwlock_acquire_writelock(rwlock_t *rwlock)
+rwlock_init(rwlock_t *rwlock)
+{
+  initlock(&rwlock->lk, "rwlock");
+  rwlock->mode = RWLOCK_PHASE_FAIR;
+  rwlock->num_readers = 0;
+  rwlock->writer = 0;
+  rwlock->wait_readers = 0;
+  rwlock->wait_writers = 0;
+}
+
+int
+rwlock_setmode(rwlock_t *rwlock, int mode)
 {
+  if(mode != RWLOCK_PREFER_READER && mode != RWLOCK_PREFER_WRITER &&
+     mode != RWLOCK_PHASE_FAIR)
+    return -1;
   acquire(&rwlock->lk);
-  rwlock->num_writers++;
+  rwlock->mode = mode;
+  pass_on(rwlock, 0);
   release(&rwlock->lk);
+  return 0;
+}
 
-  xem_wait(&rwlock->write);
+int
+rwlock_acquire_readlock(rwlock_t *rwlock)
+{
+  acquire(&rwlock->lk);
+  if(may_read(rwlock)) {
+    rwlock->num_readers++;
+    release(&rwlock->lk);
+    return 0;
+  }
+  return wait_handoff(rwlock, &rwlock->wait_readers, READERS_KEY(rwlock));
 }
 
-void
-rwlock_release_readlock(rwlock_t *rwlock)
+int
+rwlock_acquire_writelock(rwlock_t *rwlock)
 {
-  int num_readers;
+  acquire(&rwlock->lk);
+  if(!rwlock->writer && rwlock->num_readers == 0) {
+    rwlock->writer = 1;
+    release(&rwlock->lk);
+    return 0;
+  }
+  return wait_handoff(rwlock, &rwlock->wait_writers, WRITERS_KEY(rwlock));
+}
 
+int
+rwlock_release_readlock(rwlock_t *rwlock)
+{
   acquire(&rwlock->lk);
-  num_readers = --rwlock->num_readers;
-  if(num_readers == 0)
-    xem_unlock(&rwlock->write);
+  if(rwlock->writer || rwlock->num_readers == 0) {
+    release(&rwlock->lk);
+    return -1;
+  }
+  if(--rwlock->num_readers == 0)
+    pass_on(rwlock, 0);
   release(&rwlock->lk);
+  return 0;
 }
 
-void
+int
 rwlock_release_writelock(rwlock_t *rwlock)
 {
-  xem_unlock(&rwlock->write);
-
   acquire(&rwlock->lk);
-  rwlock->num_writers--;
+  if(!rwlock->writer) {
+    release(&rwlock->lk);
+    return -1;
+  }
+  rwlock->writer = 0;
+  pass_on(rwlock, 1);
   release(&rwlock->lk);
-
-  wakeup(rwlock);
+  return 0;
 }
 
 int
 sys_rwlock_init(void)
 {
   rwlock_t *rwlock;
-  if(argptr(0, (char **)&rwlock, sizeof(rwlock)) < 0 || rwlock == 0) {
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0) {
     return -1;
   }
   rwlock_init(rwlock);
@@ -86,42 +205,50 @@ int
 sys_rwlock_acquire_readlock(void)
 {
   rwlock_t *rwlock;
-  if(argptr(0, (char **)&rwlock, sizeof(rwlock)) < 0 || rwlock == 0) {
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0) {
     return -1;
   }
-  rwlock_acquire_readlock(rwlock);
-  return 0;
+  return rwlock_acquire_readlock(rwlock);
 }
 
 int
 sys_rwlock_acquire_writelock(void)
 {
   rwlock_t *rwlock;
-  if(argptr(0, (char **)&rwlock, sizeof(rwlock)) < 0 || rwlock == 0) {
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0) {
     return -1;
   }
-  rwlock_acquire_writelock(rwlock);
-  return 0;
+  return rwlock_acquire_writelock(rwlock);
 }
 
 int
 sys_rwlock_release_readlock(void)
 {
   rwlock_t *rwlock;
-  if(argptr(0, (char **)&rwlock, sizeof(rwlock)) < 0 || rwlock == 0) {
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0) {
     return -1;
   }
-  rwlock_release_readlock(rwlock);
-  return 0;
+  return rwlock_release_readlock(rwlock);
 }
 
 int
 sys_rwlock_release_writelock(void)
 {
   rwlock_t *rwlock;
-  if(argptr(0, (char **)&rwlock, sizeof(rwlock)) < 0 || rwlock == 0) {
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0) {
     return -1;
   }
-  rwlock_release_writelock(rwlock);
-  return 0;
-}
\ No newline at end of file
+  return rwlock_release_writelock(rwlock);
+}
+
+int
+sys_rwlock_setmode(void)
+{
+  rwlock_t *rwlock;
+  int mode;
+  if(argptrw(0, (char **)&rwlock, sizeof(*rwlock)) < 0 || rwlock == 0 ||
+     argint(1, &mode) < 0) {
+    return -1;
+  }
+  return rwlock_setmode(rwlock, mode);
+}
@@ -1,10 +1,17 @@
 #pragma once
-#include "semaphore.h"
+#include "spinlock.h"
 
-// Semaphores
+// Policies of a readers-writer lock. See rwlock_setmode().
+#define RWLOCK_PREFER_READER 0 // Readers enter whenever no writer holds it
+#define RWLOCK_PREFER_WRITER 1 // Queued writers go before any reader
+#define RWLOCK_PHASE_FAIR    2 // Read and write phases alternate (default)
+
+// Readers-writer Lock
 struct rwlock_t {
-  struct spinlock lk; // Spinlock for protecting rwlock_t
-  struct xem_t write; // Semaphore for writer lock
-  uint num_readers;   // The number of readers
-  uint num_writers;   // The number of writers
-};
\ No newline at end of file
+  struct spinlock lk;  // Spinlock for protecting rwlock_t
+  uint mode;           // One of RWLOCK_*
+  uint num_readers;    // The number of readers holding it
+  uint writer;         // Whether a writer holds it
+  uint wait_readers;   // The number of queued readers
+  uint wait_writers;   // The number of queued writers
+};
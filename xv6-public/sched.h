@@ -0,0 +1,6 @@
+#pragma once
+// Scheduling policies, see set_sched_policy()
+#define SCHED_STRIDE  0  // Stride scheduling with the MLFQ as one item
+#define SCHED_MLFQ    1  // MLFQ only; stride processes at its lowest level
+#define SCHED_RR      2  // xv6 round robin over the process table
+#define NSCHED        3
@@ -1,5 +1,24 @@
 #include "mlfq_scheduler.h"
 #include "stride_scheduler.h"
+#include "sched.h"
 
 // rr_scheduler.c
-extern void rr_scheduler(struct cpu *);
\ No newline at end of file
+extern void rr_scheduler(struct cpu *);
+
+// Operations of a scheduling policy, see sched_ops in proc.c.
+// All of them are called with ptable.lock held, except has_to_yield
+// which runs at a timer interrupt on the cpu of p.
+struct sched_ops {
+  const char *name;
+  void (*schedule)(struct cpu *c);     // Run runnable processes for a while
+  void (*enqueue)(struct proc *p);     // Queue p which became runnable
+  int (*has_to_yield)(struct proc *p); // Account a tick; 1 to preempt p
+};
+
+// proc.c
+extern int sched_policy;
+extern uint sched_gen; // Bumped whenever the queues are rebuilt
+void sched_run(struct cpu *c, struct proc *p);
+void sched_settle(struct proc *p);
+int sched_has_to_yield(struct proc *p);
+int sched_switch(int policy);
@@ -10,6 +10,11 @@
 #include "spinlock.h"
 #include "semaphore.h"
 
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
 void
 xem_init(xem_t *semaphore, int cap)
 {
@@ -17,23 +22,36 @@ xem_init(xem_t *semaphore, int cap)
   semaphore->lock_caps = cap;
 }
 
-void
+// Waiters queue in FIFO order on the address of the semaphore, and
+// xem_unlock() hands its unit straight to the oldest one instead of
+// waking them all to race for it.
+int
 xem_wait(xem_t *semaphore)
 {
+  struct proc *p = myproc();
+  int ret;
+
   acquire(&semaphore->lk);
-  while(semaphore->lock_caps <= 0) {
-    sleep(semaphore, &semaphore->lk);
+  if(semaphore->lock_caps > 0) {
+    --semaphore->lock_caps;
+    release(&semaphore->lk);
+    return 0;
   }
-  --semaphore->lock_caps;
+  // Queue before dropping lk so an unlock cannot miss us
+  acquire(&ptable.lock);
+  futex_enqueue(p, p->pgdir, (uint)semaphore);
   release(&semaphore->lk);
+  ret = futex_sleep(p);
+  release(&ptable.lock);
+  return ret;
 }
 
 void
 xem_unlock(xem_t *semaphore)
 {
   acquire(&semaphore->lk);
-  ++semaphore->lock_caps;
-  wakeup(semaphore);
+  if(futex_wake(myproc()->pgdir, (uint)semaphore, 1) == 0)
+    ++semaphore->lock_caps;
   release(&semaphore->lk);
 }
 
@@ -41,7 +59,7 @@ int
 sys_xem_init(void)
 {
   xem_t *semaphore;
-  if(argptr(0, (char**)&semaphore, sizeof(semaphore)) < 0) {
+  if(argptrw(0, (char**)&semaphore, sizeof(*semaphore)) < 0) {
     return -1;
   }
   xem_init(semaphore, 1);
@@ -52,18 +70,17 @@ int
 sys_xem_wait(void)
 {
   xem_t *semaphore;
-  if(argptr(0, (char**)&semaphore, sizeof(semaphore)) < 0) {
+  if(argptrw(0, (char**)&semaphore, sizeof(*semaphore)) < 0) {
     return -1;
   }
-  xem_wait(semaphore);
-  return 0;
+  return xem_wait(semaphore);
 }
 
 int
 sys_xem_unlock(void)
 {
   xem_t *semaphore;
-  if(argptr(0, (char**)&semaphore, sizeof(semaphore)) < 0) {
+  if(argptrw(0, (char**)&semaphore, sizeof(*semaphore)) < 0) {
     return -1;
   }
   xem_unlock(semaphore);
@@ -0,0 +1,156 @@
+/**
+ * This program measures concurrent readers of read-mostly data, one
+ * reader lwp per cpu. Run it with CPUS=4.
+ *
+ * 1. Every reader calls uptime(), which reads ticks under the kernel
+ *    seqlock tickslock, for DURATION ticks.
+ * 2. Every reader copies a four-word record that one writer lwp keeps
+ *    rewriting, first under a useqlock and then under a umutex. All four
+ *    words of a record are equal, so a torn copy is caught.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define DURATION 200
+#define MAXREADERS 8
+
+struct record {
+  int a, b, c, d;
+};
+
+static struct record rec;
+static useqlock_t seq;
+static umutex_t mutex;
+static int use_seqlock;
+static volatile int start, stop;
+static volatile int reads, torn;
+
+static void
+read_record(struct record *r)
+{
+  uint s;
+
+  if(use_seqlock) {
+    do {
+      s = useqlock_read_begin(&seq);
+      *r = rec;
+    } while(useqlock_read_retry(&seq, s));
+  } else {
+    umutex_lock(&mutex);
+    *r = rec;
+    umutex_unlock(&mutex);
+  }
+}
+
+void *
+clock_reader(void *arg)
+{
+  int n = 0;
+
+  while(uptime() < start)
+    ;
+  while(uptime() - start < DURATION)
+    n++;
+  __sync_fetch_and_add(&reads, n);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+record_reader(void *arg)
+{
+  struct record r;
+  int n = 0, bad = 0;
+
+  while(uptime() < start)
+    ;
+  while(!stop) {
+    read_record(&r);
+    if(r.a != r.b || r.a != r.c || r.a != r.d)
+      bad++;
+    n++;
+  }
+  __sync_fetch_and_add(&reads, n);
+  __sync_fetch_and_add(&torn, bad);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+record_writer(void *arg)
+{
+  volatile int i;
+  int v = 0;
+
+  while(uptime() < start)
+    ;
+  while(uptime() - start < DURATION) {
+    v++;
+    if(use_seqlock)
+      useqlock_write_lock(&seq);
+    else
+      umutex_lock(&mutex);
+    rec.a = v;
+    rec.b = v;
+    rec.c = v;
+    rec.d = v;
+    if(use_seqlock)
+      useqlock_write_unlock(&seq);
+    else
+      umutex_unlock(&mutex);
+    for(i = 0; i < 1000; i++) // Read-mostly: writes are rare
+      ;
+  }
+  stop = 1;
+  thread_exit(0);
+  return 0;
+}
+
+// Run nreaders lwps of reader, plus the writer if there is one,
+// and return the reads per second of all readers together
+static int
+run(void *(*reader)(void *), int nreaders, int with_writer)
+{
+  thread_t t[MAXREADERS + 1];
+  void *ret;
+  int i, n = 0;
+
+  reads = torn = stop = 0;
+  start = uptime() + 10;
+  for(i = 0; i < nreaders; i++)
+    if(thread_create(&t[n], reader, 0) == 0)
+      n++;
+  if(with_writer && thread_create(&t[n], record_writer, 0) == 0)
+    n++;
+  for(i = 0; i < n; i++)
+    thread_join(t[i], &ret);
+  return reads / DURATION * 100; // A tick is 10ms
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat st;
+  int nreaders, seq_reads, mutex_reads;
+
+  getkstat(&st);
+  nreaders = st.ncpu < MAXREADERS ? st.ncpu : MAXREADERS;
+  printf(1, "%d readers, %d ticks\n", nreaders, DURATION);
+
+  printf(1, "uptime()        %d reads/sec\n", run(clock_reader, nreaders, 0));
+
+  useqlock_init(&seq);
+  use_seqlock = 1;
+  seq_reads = run(record_reader, nreaders, 1);
+  printf(1, "useqlock record %d reads/sec, %d torn\n", seq_reads, torn);
+
+  umutex_init(&mutex);
+  use_seqlock = 0;
+  mutex_reads = run(record_reader, nreaders, 1);
+  printf(1, "umutex record   %d reads/sec, %d torn\n", mutex_reads, torn);
+
+  exit();
+}
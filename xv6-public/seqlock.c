@@ -0,0 +1,67 @@
+// Sequence locks.
+//
+// A reader copies the data between read_seqbegin() and read_seqretry()
+// and tries again if a writer was inside meanwhile:
+//
+//   do {
+//     seq = read_seqbegin(&sl);
+//     copy = data;
+//   } while(read_seqretry(&sl, seq));
+//
+// Readers never write to the lock, so they do not bounce its cache line
+// between cpus the way a spinlock taken for reading would. Writers must
+// not sleep, and the data must be safe to read while half updated since
+// the reader only finds out afterwards.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "seqlock.h"
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  initlock(&sl->lk, name);
+  sl->seq = 0;
+}
+
+void
+write_seqlock(struct seqlock *sl)
+{
+  acquire(&sl->lk);
+  sl->seq++;
+  // x86 does not reorder stores, so only keep the compiler from moving
+  // the data updates above the odd sequence number.
+  asm volatile("" ::: "memory");
+}
+
+void
+write_sequnlock(struct seqlock *sl)
+{
+  asm volatile("" ::: "memory");
+  sl->seq++;
+  release(&sl->lk);
+}
+
+// Wait for any writer to leave and return the sequence number to check
+// with read_seqretry().
+uint
+read_seqbegin(struct seqlock *sl)
+{
+  uint seq;
+
+  while((seq = sl->seq) & 1)
+    ;
+  // x86 does not reorder loads either
+  asm volatile("" ::: "memory");
+  return seq;
+}
+
+// Whether the data read since read_seqbegin() returned seq may be torn
+int
+read_seqretry(struct seqlock *sl, uint seq)
+{
+  asm volatile("" ::: "memory");
+  return sl->seq != seq;
+}
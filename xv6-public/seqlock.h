@@ -0,0 +1,10 @@
+#pragma once
+#include "spinlock.h"
+
+// Sequence lock for read-mostly data.
+// Writers take lk and bump seq to odd while they update the data;
+// readers take no lock at all and retry if seq moved under them.
+struct seqlock {
+  volatile uint seq;   // Odd while a writer is inside
+  struct spinlock lk;  // Serializes the writers
+};
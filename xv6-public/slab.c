@@ -0,0 +1,211 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache hands out objects of one size, packed into pages from kalloc()
+// behind a small header. Every cpu keeps a short list of free objects of
+// each cache, so allocating and freeing are O(1) and take the cache lock
+// only to move SLAB_CPU_BATCH objects at once between that list and the
+// slabs. A slab whose objects are all free goes back to kalloc(), except
+// one which the cache keeps to avoid bouncing a page on every alloc/free.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "slab.h"
+
+#define SLAB_CPU_SIZE  16
+#define SLAB_CPU_BATCH (SLAB_CPU_SIZE / 2)
+
+// Header at the start of each slab page
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;        // On the partial list of the cache
+  struct slab *prev;
+  struct kobj *free;        // Free objects of this slab
+  uint inuse;               // Objects handed out, or on a cpu list
+};
+
+struct kobj {
+  struct kobj *next;
+};
+
+#define SLAB_HDR ((sizeof(struct slab) + 7) & ~7)
+
+extern char end[]; // first address after kernel loaded from ELF file
+
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  if(size < sizeof(struct kobj))
+    size = sizeof(struct kobj);
+  size = (size + 3) & ~3;
+  if(size > PGSIZE - SLAB_HDR)
+    panic("kmem_cache_init");
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLAB_HDR) / size;
+  initlock(&c->lock, name);
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  if((s->next = c->partial) != 0)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+slab_unlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Find a slab with a free object, taking a new page if there is none.
+// The caller must hold c->lock.
+static struct slab*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct kobj *o;
+  char *p;
+  uint i;
+
+  if((s = c->partial) != 0)
+    return s;
+  if((s = c->empty) != 0){
+    c->empty = 0;
+    slab_link(c, s);
+    return s;
+  }
+  if((p = kalloc()) == 0)
+    return 0;
+  s = (struct slab*)p;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = c->perslab; i > 0; i--){
+    o = (struct kobj*)(p + SLAB_HDR + (i - 1) * c->size);
+    o->next = s->free;
+    s->free = o;
+  }
+  c->nslab++;
+  slab_link(c, s);
+  return s;
+}
+
+// Give an object back to its slab. The caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, struct kobj *o)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint)o);
+
+  if(s->cache != c || s->inuse == 0)
+    panic("kmem_cache_free");
+  if(s->free == 0)
+    slab_link(c, s); // Was full
+  o->next = s->free;
+  s->free = o;
+  if(--s->inuse > 0)
+    return;
+  slab_unlink(c, s);
+  if(c->empty == 0){
+    c->empty = s;
+    return;
+  }
+  c->nslab--;
+  kfree((char*)s);
+}
+
+// Move up to SLAB_CPU_BATCH objects from the slabs to the list of cpu.
+static void
+cpu_refill(struct kmem_cache *c, int cpu)
+{
+  struct slab *s;
+  struct kobj *o;
+
+  acquire(&c->lock);
+  while(c->cpu[cpu].n < SLAB_CPU_BATCH && (s = slab_get(c)) != 0){
+    o = s->free;
+    s->free = o->next;
+    if(s->free == 0)
+      slab_unlink(c, s); // Now full
+    s->inuse++;
+    o->next = c->cpu[cpu].list;
+    c->cpu[cpu].list = o;
+    c->cpu[cpu].n++;
+  }
+  release(&c->lock);
+}
+
+// Give SLAB_CPU_BATCH objects of a full cpu list back to their slabs.
+static void
+cpu_drain(struct kmem_cache *c, int cpu)
+{
+  struct kobj *o;
+  int i;
+
+  acquire(&c->lock);
+  for(i = 0; i < SLAB_CPU_BATCH; i++){
+    o = c->cpu[cpu].list;
+    c->cpu[cpu].list = o->next;
+    c->cpu[cpu].n--;
+    slab_put(c, o);
+  }
+  release(&c->lock);
+}
+
+// Allocate an object of c, not cleared.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kobj *o;
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  if(c->cpu[cpu].n == 0)
+    cpu_refill(c, cpu);
+  if((o = c->cpu[cpu].list) != 0){
+    c->cpu[cpu].list = o->next;
+    c->cpu[cpu].n--;
+  }
+  popcli();
+  return o;
+}
+
+// Free an object which kmem_cache_alloc(c) returned.
+void
+kmem_cache_free(struct kmem_cache *c, void *v)
+{
+  struct kobj *o = v;
+  uint off = (uint)v % PGSIZE;
+  int cpu;
+
+  if((char*)v < end || V2P(v) >= PHYSTOP || off < SLAB_HDR ||
+     (off - SLAB_HDR) % c->size)
+    panic("kmem_cache_free");
+
+#ifdef KALLOC_DEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, c->size);
+#endif
+
+  pushcli();
+  cpu = cpuid();
+  o->next = c->cpu[cpu].list;
+  c->cpu[cpu].list = o;
+  if(++c->cpu[cpu].n > SLAB_CPU_SIZE)
+    cpu_drain(c, cpu);
+  popcli();
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "spinlock.h"
+
+// Cache of fixed-size kernel objects carved out of kalloc() pages.
+// Include param.h first for NCPU.
+struct kmem_cache {
+  char *name;
+  uint size;            // Bytes per object
+  uint perslab;         // Objects in one slab page
+  struct spinlock lock; // Protects the slab lists below
+  struct slab *partial; // Slabs with objects both free and in use
+  struct slab *empty;   // One slab with nothing in use, kept for reuse
+  uint nslab;           // Slab pages held by the cache
+  struct {
+    void *list;         // Free objects cached by the cpu
+    int n;              // Length of list
+  } cpu[NCPU];
+};
@@ -0,0 +1,111 @@
+/**
+ * This program measures the objects which now come from slab caches.
+ * One worker per cpu keeps creating and joining a thread, which allocates
+ * and frees a struct lwp, and then keeps creating and closing a pipe, which
+ * allocates and frees a struct pipe and two struct files. It reports both
+ * rates per second over DURATION ticks each. Run it with CPUS=4.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define DURATION 200
+#define MAXWORKERS 8
+
+static void *
+nop(void *arg)
+{
+  thread_exit(0);
+  return 0;
+}
+
+// Thread create/join rounds until end
+static int
+bench_thread(int end)
+{
+  thread_t t;
+  void *ret;
+  int n = 0;
+
+  while(uptime() < end) {
+    if(thread_create(&t, nop, 0) != 0 || thread_join(t, &ret) != 0)
+      return -1;
+    n++;
+  }
+  return n;
+}
+
+// Pipe create/close rounds until end
+static int
+bench_pipe(int end)
+{
+  int fds[2], n = 0;
+
+  while(uptime() < end) {
+    if(pipe(fds) < 0)
+      return -1;
+    close(fds[0]);
+    close(fds[1]);
+    n++;
+  }
+  return n;
+}
+
+static void
+worker(int start, int out)
+{
+  int result[2];
+
+  while(uptime() < start)
+    ;
+  result[0] = bench_thread(start + DURATION);
+  result[1] = bench_pipe(start + 2 * DURATION);
+  write(out, result, sizeof result);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat st;
+  int fds[2], i, n, nworkers, start, result[2];
+  int threads = 0, pipes = 0, failed = 0;
+
+  getkstat(&st);
+  nworkers = st.ncpu < MAXWORKERS ? st.ncpu : MAXWORKERS;
+  if(pipe(fds) < 0) {
+    printf(1, "pipe failure\n");
+    exit();
+  }
+
+  start = uptime() + 10;
+  for(i = 0; i < nworkers; i++) {
+    if((n = fork()) < 0) {
+      printf(1, "FAIL : fork\n");
+      exit();
+    }
+    if(n == 0) {
+      close(fds[0]);
+      worker(start, fds[1]);
+      exit();
+    }
+  }
+  for(i = 0; i < nworkers; i++) {
+    wait();
+    if(read(fds[0], result, sizeof result) != sizeof result ||
+       result[0] < 0 || result[1] < 0) {
+      failed = 1;
+      continue;
+    }
+    threads += result[0];
+    pipes += result[1];
+  }
+
+  printf(1, "%d workers, %d ticks each\n", nworkers, DURATION);
+  printf(1, "%d thread create/join per sec\n", threads * 100 / DURATION);
+  printf(1, "%d pipe create/close per sec\n", pipes * 100 / DURATION);
+  if(failed)
+    printf(1, "FAIL\n");
+  exit();
+}
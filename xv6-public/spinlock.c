@@ -11,12 +11,89 @@
 
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initlock_kind(lk, name, SPIN_TAS);
+}
+
+// Initialize a lock of the given kind. Test-and-set is the cheapest
+// uncontended; under contention every waiter hammers its cache line and
+// the winner is arbitrary. A ticket lock serves waiters in FIFO order.
+// An MCS lock is FIFO too and each waiter spins on a node of its own
+// cpu, so a release only disturbs the next waiter.
+void
+initlock_kind(struct spinlock *lk, char *name, int kind)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->nacquire = 0;
+  lk->kind = kind;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->tail = 0;
+  lk->node = 0;
   lk->cpu = 0;
 }
 
+// Wait a moment for a lock. Interrupts are off, so answer here a TLB
+// flush which the cpu holding the lock may be waiting for.
+static inline void
+spinwait(struct cpu *c)
+{
+  if(c->tlbreq)
+    tlbflush(c);
+  pause();
+}
+
+static struct mcs_node *
+mcs_alloc(struct cpu *c)
+{
+  int i;
+
+  for(i = 0; i < NMCSNODE; i++){
+    if((c->mcs_used & (1 << i)) == 0){
+      c->mcs_used |= 1 << i;
+      return &c->mcs[i];
+    }
+  }
+  panic("mcs_alloc");
+}
+
+static void
+mcs_acquire(struct spinlock *lk)
+{
+  struct cpu *c = mycpu();
+  struct mcs_node *node, *prev;
+
+  node = mcs_alloc(c);
+  node->next = 0;
+  node->wait = 1;
+  prev = (struct mcs_node*)xchg((volatile uint*)&lk->tail, (uint)node);
+  if(prev != 0){
+    prev->next = node;
+    while(node->wait)
+      spinwait(c);
+  }
+  lk->node = node;
+}
+
+static void
+mcs_release(struct spinlock *lk)
+{
+  struct mcs_node *node = lk->node;
+  struct cpu *c = mycpu();
+
+  if(node->next == 0){
+    // No known successor: free the lock unless one is just arriving
+    if(cmpxchg((volatile uint*)&lk->tail, (uint)node, 0) == (uint)node)
+      goto done;
+    while(node->next == 0)
+      spinwait(c);
+  }
+  node->next->wait = 0;
+done:
+  c->mcs_used &= ~(1 << (node - c->mcs));
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
@@ -24,13 +101,35 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct cpu *c;
+  uint ticket;
+
   pushcli(); // disable interrupts to avoid deadlock.
+  c = mycpu();
+#ifdef SPINLOCK_DEBUG
   if(holding(lk))
     panic("acquire");
-
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+#else
+  if(lk->locked && lk->cpu == c)
+    panic("acquire");
+#endif
+
+  switch(lk->kind){
+  case SPIN_TICKET:
+    ticket = __sync_fetch_and_add(&lk->next, 1);
+    while(lk->owner != ticket)
+      spinwait(c);
+    lk->locked = 1;
+    break;
+  case SPIN_MCS:
+    mcs_acquire(lk);
+    lk->locked = 1;
+    break;
+  default:
+    // The xchg is atomic.
+    while(xchg(&lk->locked, 1) != 0)
+      spinwait(c);
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,18 +137,27 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
-  lk->cpu = mycpu();
+  lk->nacquire++;
+  lk->cpu = c;
+#ifdef SPINLOCK_DEBUG
   getcallerpcs(&lk, lk->pcs);
+#endif
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+#ifdef SPINLOCK_DEBUG
   if(!holding(lk))
     panic("release");
-
   lk->pcs[0] = 0;
+#else
+  // Interrupts are off while a lock is held, so mycpu() is safe here
+  if(!lk->locked || lk->cpu != mycpu())
+    panic("release");
+#endif
+
   lk->cpu = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -64,6 +172,16 @@ release(struct spinlock *lk)
   // not be atomic. A real OS would use C atomics here.
   asm volatile("movl $0, %0" : "+m" (lk->locked) : );
 
+  switch(lk->kind){
+  case SPIN_TICKET:
+    // Only the holder writes owner
+    lk->owner++;
+    break;
+  case SPIN_MCS:
+    mcs_release(lk);
+    break;
+  }
+
   popcli();
 }
 
@@ -104,23 +222,28 @@ holding(struct spinlock *lock)
 void
 pushcli(void)
 {
+  struct cpu *c;
   int eflags;
 
   eflags = readeflags();
   cli();
-  if(mycpu()->ncli == 0)
-    mycpu()->intena = eflags & FL_IF;
-  mycpu()->ncli += 1;
+  c = mycpu();
+  if(c->ncli == 0)
+    c->intena = eflags & FL_IF;
+  c->ncli += 1;
 }
 
 void
 popcli(void)
 {
+  struct cpu *c;
+
   if(readeflags()&FL_IF)
     panic("popcli - interruptible");
-  if(--mycpu()->ncli < 0)
+  c = mycpu();
+  if(--c->ncli < 0)
     panic("popcli");
-  if(mycpu()->ncli == 0 && mycpu()->intena)
+  if(c->ncli == 0 && c->intena)
     sti();
 }
 
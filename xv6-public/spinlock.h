@@ -1,7 +1,29 @@
 #pragma once
+
+// Kinds of spin lock. See initlock_kind().
+#define SPIN_TAS    0 // Test-and-set on locked; no order among waiters
+#define SPIN_TICKET 1 // Waiters are served in the order they arrived
+#define SPIN_MCS    2 // Like ticket, but each waiter spins on its own node
+
+// Queue node of an MCS lock waiter. Each cpu has a few in struct cpu.
+struct mcs_node {
+  struct mcs_node *volatile next; // Waiter behind this one
+  volatile uint wait;             // Cleared by the predecessor's release
+};
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint nacquire;     // Number of acquisitions, for statistics
+  uint kind;         // One of SPIN_*
+
+  // SPIN_TICKET
+  uint next;                   // Ticket handed to the next arrival
+  volatile uint owner;         // Ticket being served
+
+  // SPIN_MCS
+  struct mcs_node *volatile tail; // Last waiter, or 0 if free
+  struct mcs_node *node;          // Node of the holder
 
   // For debugging:
   char *name;        // Name of lock.
@@ -9,4 +31,3 @@ struct spinlock {
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
 };
-
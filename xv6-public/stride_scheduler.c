@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "seqlock.h"
 #include "schedulers.h"
 
 extern struct {
@@ -13,16 +14,47 @@ extern struct {
   struct proc proc[NPROC];
 } ptable;
 
-struct spinlock stride_lock;
 StrideQueue stride_queue;
 uint stride_ticks;
 
+// all_share is updated under ptable.lock; the seqlock lets
+// stride_all_share() read it without taking that lock.
+static struct seqlock share_seq;
+
+static void
+add_all_share(int delta)
+{
+  write_seqlock(&share_seq);
+  stride_queue.all_share += delta;
+  write_sequnlock(&share_seq);
+}
+
+// Total cpu share reserved by the MLFQ and the stride processes
+int
+stride_all_share(void)
+{
+  uint seq;
+  int all_share;
+
+  do {
+    seq = read_seqbegin(&share_seq);
+    all_share = stride_queue.all_share;
+  } while(read_seqretry(&share_seq, seq));
+  return all_share;
+}
+
+static uint
+stride_of(int share)
+{
+  return share > 0 ? STRIDE_LARGE / share : 0;
+}
+
 void
 stride_item_init(StrideItem *item, uint share, void *proc, uint isMLFQ)
 {
   item->share = share;
-  item->pass.num = stride_queue.max_pass.num;
-  item->pass.denom = stride_queue.max_pass.denom;
+  item->stride = stride_of(share);
+  item->pass = stride_queue.max_pass;
   item->proc = proc;
   item->isMLFQ = isMLFQ;
 }
@@ -37,12 +69,29 @@ stride_item_copy(StrideItem *dest, const StrideItem *src)
   dest->share = src->share;
   dest->isMLFQ = src->isMLFQ;
   dest->proc = src->proc;
-  dest->pass.denom = src->pass.denom;
-  dest->pass.num = src->pass.num;
+  dest->stride = src->stride;
+  dest->pass = src->pass;
   return 0;
 }
 
-#define HEAP_LESS_THAN(a, b) !frac_is_less_than((a), (b))
+// Each item remembers its slot in the heap: a process in its proc,
+// the MLFQ item in the stride queue. Slot 0 means "not in the heap".
+static uint *
+heap_slot(const StrideItem *item)
+{
+  if(item->isMLFQ)
+    return &stride_queue.mlfq_idx;
+  return &((struct proc *)item->proc)->stride_idx;
+}
+
+// Store item at idx and update its back index
+static void
+heap_place(StrideHeap *heap, uint idx, const StrideItem *item)
+{
+  stride_item_copy(&heap->items[idx], item);
+  if(item->isMLFQ || item->proc)
+    *heap_slot(item) = idx;
+}
 
 static void
 heap_init(StrideHeap *heap)
@@ -65,46 +114,75 @@ heap_empty(const StrideHeap *heap)
   return heap->size == 0;
 }
 
+static void
+heap_sift_up(StrideHeap *heap, uint idx)
+{
+  StrideItem item;
+
+  stride_item_copy(&item, &heap->items[idx]);
+  while(idx != 1 && PASS_LESS_THAN(item.pass, heap->items[idx >> 1].pass)) {
+    heap_place(heap, idx, &heap->items[idx >> 1]);
+    idx = idx >> 1;
+  }
+  heap_place(heap, idx, &item);
+}
+
+static void
+heap_sift_down(StrideHeap *heap, uint idx)
+{
+  StrideItem item;
+  uint child;
+
+  stride_item_copy(&item, &heap->items[idx]);
+  while((child = idx << 1) <= heap->size) {
+    /* compare left and right child’s key passs */
+    if(child < heap->size &&
+       PASS_LESS_THAN(heap->items[child + 1].pass, heap->items[child].pass))
+      child++;
+    if(!PASS_LESS_THAN(heap->items[child].pass, item.pass))
+      break; /* move to the next lower level */
+    heap_place(heap, idx, &heap->items[child]);
+    idx = child;
+  }
+  heap_place(heap, idx, &item);
+}
+
 static int
 heap_push_item(StrideHeap *heap, const StrideItem *item)
 {
-  int idx;
   if(heap_full(heap)) {
     return -1; // The heap is full.
   }
-  idx = ++heap->size;
-  while((idx != 1) &&
-        !HEAP_LESS_THAN(&item->pass, &heap->items[idx / 2].pass)) {
-    stride_item_copy(&heap->items[idx], &heap->items[idx >> 1]);
-    idx = idx >> 1;
+  heap_place(heap, ++heap->size, item);
+  heap_sift_up(heap, heap->size);
+  return 0;
+}
+
+// Remove the item at idx by moving the last item into the hole
+// and fixing only the path of the moved item.
+static int
+heap_remove_item(StrideHeap *heap, uint idx)
+{
+  if(idx < 1 || idx > heap->size)
+    return -1;
+  *heap_slot(&heap->items[idx]) = 0;
+  if(idx != heap->size) {
+    heap_place(heap, idx, &heap->items[heap->size--]);
+    heap_sift_up(heap, idx);
+    heap_sift_down(heap, idx);
+  } else {
+    heap->size--;
   }
-  stride_item_copy(&heap->items[idx], item);
   return 0;
 }
 
 static int
 heap_pop_item(StrideHeap *heap)
 {
-  StrideItem *temp;
-  uint parent = 1;
-  uint child = 2;
   if(heap_empty(heap)) {
     return -1; // The heap is empty
   }
-  temp = &heap->items[heap->size--];
-  while(child <= heap->size) {
-    /* compare left and right child’s key passs */
-    if((child < heap->size) &&
-       HEAP_LESS_THAN(&heap->items[child].pass, &heap->items[child + 1].pass))
-      child++;
-    if(!HEAP_LESS_THAN(&temp->pass, &heap->items[child].pass))
-      break; /* move to the next lower level */
-    stride_item_copy(&heap->items[parent], &heap->items[child]);
-    parent = child;
-    child = child << 1;
-  }
-  stride_item_copy(&heap->items[parent], temp);
-  return 0;
+  return heap_remove_item(heap, 1);
 }
 
 static StrideItem *
@@ -115,12 +193,27 @@ heap_top_item(StrideHeap *heap)
   return &heap->items[1];
 }
 
+// Empty the heap except for the MLFQ item. Shares stay reserved.
 void
-stride_init(void)
+stride_reset(void)
 {
-  stride_queue.all_share = 0;
-  frac_zero(&stride_queue.max_pass);
+  StrideItem mlfq_item;
+
+  stride_queue.max_pass = 0;
+  stride_queue.mlfq_idx = 0;
+  stride_queue.base_pass = 0;
   heap_init(&stride_queue.q);
+  stride_item_init(&mlfq_item, STRIDE_MLFQ_SHARE, 0, 1);
+  heap_push_item(&stride_queue.q, &mlfq_item);
+}
+
+// Called once at boot, before any cpu runs the scheduler.
+void
+stride_init(void)
+{
+  initseqlock(&share_seq, "stride_share");
+  stride_queue.all_share = STRIDE_MLFQ_SHARE;
+  stride_reset();
 }
 
 int
@@ -128,7 +221,7 @@ stride_push(const StrideItem *item)
 {
   if(!item)
     return 0;
-  stride_queue.all_share += item->share;
+  add_all_share(item->share);
   return heap_push_item(&stride_queue.q, item);
 }
 
@@ -138,7 +231,7 @@ stride_pop(void)
   StrideItem *item = stride_top();
   if(item == 0)
     return -1;
-  stride_queue.all_share -= item->share;
+  add_all_share(-item->share);
   return heap_pop_item(&stride_queue.q);
 }
 
@@ -151,93 +244,169 @@ stride_top(void)
 int
 stride_can_change_share(int old_share, int new_share)
 {
-  return stride_queue.all_share - old_share + new_share <= STRIDE_MAX_SHARE;
+  return stride_all_share() - old_share + new_share <= STRIDE_MAX_SHARE;
 }
 
+// Move p from the MLFQ to the stride queue by reserving share for it.
+// p joins the heap through stride_wakeup() behind every other item.
 int
-stride_adjust(StrideItem *item, int new_share)
+stride_join(struct proc *p, int share)
 {
-  if(!item || heap_empty(&stride_queue.q))
+  if(!stride_can_change_share(0, share))
     return -1;
-  if(!stride_can_change_share(item->share, new_share))
+  add_all_share(share);
+  p->lev = STRIDE_PROC_LEVEL;
+  p->cticks = 0;
+  p->stride_share = share;
+  p->stride_pass = stride_queue.max_pass + stride_queue.base_pass;
+  return 0;
+}
+
+// Change the share of a stride process, in the heap or not.
+int
+stride_set_share(struct proc *p, int new_share)
+{
+  StrideItem *item;
+
+  if(!stride_can_change_share(p->stride_share, new_share))
     return -1;
-  stride_queue.all_share -= item->share;
-  item->share = new_share;
-  stride_queue.all_share += item->share;
+  add_all_share(new_share - p->stride_share);
+  p->stride_share = new_share;
+  if((item = stride_find_item(p)) != 0) {
+    item->share = new_share;
+    item->stride = stride_of(new_share);
+  }
   return 0;
 }
 
+// Release the share of an exiting process.
+// Its item leaves the heap once the scheduler sees it as a zombie.
+void
+stride_leave(struct proc *p)
+{
+  add_all_share(-p->stride_share);
+  p->stride_share = 0;
+}
+
 int
 is_stride(struct proc *p)
 {
   return p && p->lev == STRIDE_PROC_LEVEL;
 }
 
+// Remove an item from the heap; its share is released by stride_leave().
 int
 stride_remove(StrideItem *s)
 {
   if(!s)
     return -1;
 
-  int idx = s - stride_queue.q.items;
-  stride_adjust(&stride_queue.q.items[idx], 0);
-  stride_item_copy(&stride_queue.q.items[idx],
-                   &stride_queue.q.items[stride_queue.q.size--]);
-
-  StrideItem t;
-  StrideItem *child;
-  for(int n = stride_queue.q.size / 2; n >= 1; n--) {
-    child = &stride_queue.q.items[2 * n];
-    if(2 * n + 1 <= stride_queue.q.size &&
-       HEAP_LESS_THAN(&((child + 1)->pass), &child->pass)) {
-      child = child + 1;
-    }
-    if(HEAP_LESS_THAN(&child->pass, &stride_queue.q.items[n].pass)) {
-      stride_item_copy(&t, child);
-      stride_item_copy(child, &stride_queue.q.items[n]);
-      stride_item_copy(&stride_queue.q.items[n], &t);
-    }
-  }
-  return 0;
+  return heap_remove_item(&stride_queue.q, s - stride_queue.q.items);
 }
 
-// Called at trap
-int
-stride_has_to_yield(struct proc *p)
+// Take a process which went to sleep out of the heap so that it is
+// neither picked nor charged while asleep. Its share stays reserved.
+void
+stride_sleep(StrideItem *item)
 {
-  static uint stride_ticks_elapsed;
+  struct proc *p = item->proc;
 
-  if(stride_ticks_elapsed >= STRIDE_MAX_TICKS)
-    stride_ticks_elapsed = 0;
+  p->stride_pass = item->pass + stride_queue.base_pass;
+  heap_remove_item(&stride_queue.q, item - stride_queue.q.items);
+}
 
-  acquire(&stride_lock);
-  stride_ticks += 1; // Increase the Stride tick count
-  release(&stride_lock);
+// Put a woken-up process back into the heap. Like virtual time in WFQ,
+// its pass is clamped to the global pass, the minimum pass in the heap,
+// so that a long sleep does not turn into a burst of catch-up slices.
+int
+stride_wakeup(struct proc *p)
+{
+  StrideItem item;
+  pass_t pass;
+
+  if(p->stride_idx != 0)
+    return 0; // Still in the heap
+  stride_item_init(&item, p->stride_share, p, 0);
+  pass = p->stride_pass - stride_queue.base_pass;
+  if(PASS_LESS_THAN(pass, stride_top()->pass))
+    pass = stride_top()->pass;
+  item.pass = pass;
+  return heap_push_item(&stride_queue.q, &item);
+}
 
-  stride_ticks_elapsed++; // Increase the time quantom the current process can
-                          // use
+// Called at trap with interrupts disabled.
+// Only touches the running process and this cpu, so no lock is needed.
+int
+stride_has_to_yield(struct proc *p)
+{
+  struct cpu *c = mycpu();
 
-  acquire(&ptable.lock);
-  p->cticks += 1; // Increase the process's tick count
-  if(stride_ticks_elapsed >= STRIDE_MAX_TICKS)
-    p->yield_by = 1;
-  release(&ptable.lock);
+  __sync_fetch_and_add(&stride_ticks, 1); // Increase the Stride tick count
 
-  return stride_ticks_elapsed >= STRIDE_MAX_TICKS;
+  // Increase the process's tick count; its lwps may tick on other cpus
+  __sync_fetch_and_add(&p->cticks, 1);
+  if(++c->stride_slice < STRIDE_MAX_TICKS)
+    return 0;
+  c->yield_by = 1;
+  return 1;
 }
 
 StrideItem *
 stride_find_item(const struct proc *p)
 {
-  StrideItem *const begin = stride_queue.q.items, *const end =
-                                                      begin +
-                                                      stride_queue.q.size;
-  for(StrideItem *it = begin; it != end; it++) {
-    if(p == it->proc) {
-      return it;
+  if(p == 0 || p->stride_idx == 0 || p->stride_idx > stride_queue.q.size)
+    return 0;
+  if(stride_queue.q.items[p->stride_idx].proc != p)
+    panic("stride_find_item: stale heap index");
+  return &stride_queue.q.items[p->stride_idx];
+}
+
+// Shift every pass down by the minimum pass so that the values stay
+// small after a long uptime. Subtracting the same amount from every
+// item keeps the heap order intact.
+static void
+stride_renormalize(void)
+{
+  StrideItem *top = stride_top();
+  pass_t base;
+  uint i;
+
+  if(top == 0)
+    return;
+  base = top->pass;
+  for(i = 1; i <= stride_queue.q.size; i++)
+    stride_queue.q.items[i].pass -= base;
+  stride_queue.max_pass -= base;
+  stride_queue.base_pass += base;
+}
+
+// The item with the minimum pass among those which may run on cpu c.
+// The top is often not one of them, since its lwps may all be running
+// on other cpus. The search walks down the heap only below items which
+// c cannot run, and skips subtrees which cannot beat the best candidate,
+// so it visits about twice as many items as there are ahead of the pick,
+// which is at most the number of busy cpus plus the pinned processes.
+// The MLFQ item runs anywhere, so there is always a candidate.
+static StrideItem *
+stride_pick(struct cpu *c)
+{
+  StrideItem *items = stride_queue.q.items, *best = 0;
+  uint stack[1 + NPROC], n = 0, idx, child;
+
+  stack[n++] = 1;
+  while(n > 0) {
+    idx = stack[--n];
+    if(best && !PASS_LESS_THAN(items[idx].pass, best->pass))
+      continue; // Neither this item nor anything below it comes first
+    if(items[idx].isMLFQ || proc_allowed(items[idx].proc, c)) {
+      best = &items[idx];
+      continue;
     }
+    for(child = idx << 1; child <= (idx << 1) + 1; child++)
+      if(child <= stride_queue.q.size)
+        stack[n++] = child;
   }
-  return 0;
+  return best;
 }
 
 void
@@ -251,7 +420,7 @@ stride_print(void)
   int i;
   cprintf("Stride Info\n"
           "All Share = %d\n",
-          stride_queue.all_share);
+          stride_all_share());
 
   for(i = 1; i <= stride_queue.q.size; i++) {
     s = &stride_queue.q.items[i];
@@ -269,64 +438,54 @@ stride_print(void)
 void
 stride_scheduler(struct cpu *c)
 {
-  StrideItem item, *top;
-  frac stride;
-
-  // Fetch a top element from the stride
-  top = stride_top();
-  if(stride_item_copy(&item, top)) {
-    panic("Error occured during copying stride item");
-  }
-
-  if(item.isMLFQ) {
+  StrideItem *top;
+  struct proc *p;
+  uint isMLFQ, gen = sched_gen;
+
+  // Fetch the top element this cpu may run
+  if(stride_top() == 0)
+    panic("Stride queue is empty");
+  top = stride_pick(c);
+  isMLFQ = top->isMLFQ;
+  p = top->proc;
+  c->stride_slice = 0;
+
+  if(isMLFQ) {
     // Do the MLFQ
     mlfq_scheduler(c);
-  } else {
-    struct proc *p = item.proc;
-
-    if(p->state != RUNNABLE)
-      goto stride_pass;
-
-    // Switch to chosen process.  It is the process's job
-    // to release ptable.lock and then reacquire it
-    // before jumping back to us.
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
-
-    swtch(&(c->scheduler), mylwp(p)->context);
-    switchkvm();
-
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+  } else if(p->state == RUNNABLE) {
+    // Run one lwp of p. Its other lwps may be running on other
+    // cpus; every run is charged to p.
+    sched_run(c, p);
+    sched_settle(p);
   }
 
-stride_pass:
-  // Pop the item
-  if(stride_pop())
+  // The queues were rebuilt for another policy while p was running
+  if(gen != sched_gen)
     return;
 
-  uint all_share = stride_queue.all_share + item.share;
-
-  // Add the pass
-  if(frac_init(&stride, all_share,
-               item.share) || // stride = all_share / item.share
-     frac_add(&item.pass, &item.pass, &stride)) { // item.pass += stride
-    if(stride_push(&item))
-      panic("Stride item cannot be pushed\n");
+  // The item may have moved while the lock was released,
+  // so look it up again through its back index.
+  if(isMLFQ)
+    top = &stride_queue.q.items[stride_queue.mlfq_idx];
+  else if((top = stride_find_item(p)) == 0)
     return;
-  }
 
-  // Update the max pass
-  if(frac_is_less_than(&stride_queue.max_pass, &item.pass)) {
-    if(frac_init(&stride_queue.max_pass, item.pass.num, item.pass.denom))
-      panic("cannot update the max pass\n");
+  // Remove exited processes
+  if(!isMLFQ && p->state == ZOMBIE) {
+    stride_remove(top);
+    return;
   }
 
-  // Put it back alive
-  if(item.isMLFQ || ((struct proc *)item.proc)->state != ZOMBIE) {
-    if(stride_push(&item))
-      panic("Stride item cannot be pushed\n");
-  }
-}
\ No newline at end of file
+  // Add the pass and move the item down to its new place
+  top->pass += top->stride;
+  if(PASS_LESS_THAN(stride_queue.max_pass, top->pass))
+    stride_queue.max_pass = top->pass;
+  if(!isMLFQ && p->state == SLEEPING)
+    stride_sleep(top); // setrunnable() puts it back on wakeup
+  else
+    heap_sift_down(&stride_queue.q, top - stride_queue.q.items);
+
+  if(stride_queue.max_pass >= STRIDE_RENORM_PASS)
+    stride_renormalize();
+}
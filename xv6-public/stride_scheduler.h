@@ -1,18 +1,27 @@
 #ifndef _H_STRIDE_SCHEDULER_
 #define _H_STRIDE_SCHEDULER_
-#include "fraction.h"
+#include "types.h"
 #include "param.h"
 
 #define STRIDE_MAX_TICKS 5
 #define STRIDE_PROC_LEVEL 100
 #define STRIDE_MLFQ_SHARE 22
 #define STRIDE_MAX_SHARE 102
+#define STRIDE_LARGE (1 << 20)          // stride = STRIDE_LARGE / share
+#define STRIDE_RENORM_PASS (1ULL << 40) // renormalize passes beyond this
+
+// Passes are 64-bit fixed-point values which only ever grow.
+// Compare them through PASS_LESS_THAN so that a wrapped counter still
+// orders correctly as long as live passes are within 2^63 of each other.
+typedef unsigned long long pass_t;
+#define PASS_LESS_THAN(a, b) ((long long)((a) - (b)) < 0)
 
 typedef struct StrideItem StrideItem;
 typedef struct StrideHeap StrideHeap;
 typedef struct StrideQueue StrideQueue;
 struct StrideItem {
-  frac pass;
+  pass_t pass;
+  uint stride;
   uint isMLFQ : 1;
   int share : 31;
   void *proc;
@@ -23,9 +32,13 @@ struct StrideHeap {
   StrideItem items[1 + NPROC];
 };
 
+// The heap only holds the MLFQ item and stride processes which are not
+// asleep. A sleeping process keeps its share reserved in all_share.
 struct StrideQueue {
   int all_share;
-  frac max_pass;
+  uint mlfq_idx;     // Slot of the MLFQ item in the heap
+  pass_t max_pass;
+  pass_t base_pass;  // Total amount subtracted by renormalization
   StrideHeap q;
 };
 
@@ -42,7 +55,14 @@ int stride_push(const StrideItem *item);
 int stride_pop(void);
 StrideItem *stride_top(void);
 int stride_can_change_share(int old_share, int new_share);
-int stride_adjust(StrideItem *item, int new_share);
+int stride_all_share(void);
+void stride_reset(void);
+int stride_join(struct proc *p, int share);
+int stride_set_share(struct proc *p, int new_share);
+void stride_leave(struct proc *p);
+int stride_remove(StrideItem *item);
+void stride_sleep(StrideItem *item);
+int stride_wakeup(struct proc *p);
 void stride_scheduler(struct cpu *c);
 void stride_print(void);
 int stride_has_to_yield(struct proc *p);
@@ -0,0 +1,114 @@
+/**
+ * This program compares the per-pick cost of the stride scheduler
+ * with rational passes (fraction.c) and with 64-bit fixed-point passes.
+ * Both variants pick the item with the minimum pass and charge it a stride,
+ * exactly like stride_scheduler() does on every scheduling decision.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fraction.h"
+
+#define NITEMS 10
+#define NPICKS 1000000
+#define STRIDE_LARGE (1 << 20)
+
+typedef unsigned long long pass_t;
+#define PASS_LESS_THAN(a, b) ((long long)((a) - (b)) < 0)
+
+static const int shares[NITEMS] = {1, 3, 5, 7, 11, 13, 17, 23, 22, 0};
+
+static int
+all_shares(void)
+{
+  int i, sum = 0;
+  for(i = 0; i < NITEMS; i++)
+    sum += shares[i];
+  return sum;
+}
+
+/**
+ * Old representation: pass += all_share / share as a fraction.
+ * Returns the number of picks whose pass could not be advanced anymore.
+ */
+static int
+bench_frac(int *elapsed)
+{
+  frac pass[NITEMS], stride;
+  int i, min, n, overflows = 0;
+  int all_share = all_shares();
+  int start_tick;
+
+  for(i = 0; i < NITEMS; i++)
+    frac_zero(&pass[i]);
+
+  start_tick = uptime();
+  for(n = 0; n < NPICKS; n++) {
+    min = -1;
+    for(i = 0; i < NITEMS; i++) {
+      if(shares[i] == 0)
+        continue;
+      if(min < 0 || frac_is_less_than(&pass[i], &pass[min]))
+        min = i;
+    }
+    if(frac_init(&stride, all_share, shares[min]) ||
+       frac_add(&pass[min], &pass[min], &stride))
+      overflows++;
+  }
+  *elapsed = uptime() - start_tick;
+  return overflows;
+}
+
+/**
+ * New representation: pass += STRIDE_LARGE / share as a 64-bit integer.
+ */
+static int
+bench_fixed(int *elapsed)
+{
+  pass_t pass[NITEMS];
+  uint stride[NITEMS];
+  int i, min, n;
+  int start_tick;
+
+  for(i = 0; i < NITEMS; i++) {
+    pass[i] = 0;
+    stride[i] = shares[i] ? STRIDE_LARGE / shares[i] : 0;
+  }
+
+  start_tick = uptime();
+  for(n = 0; n < NPICKS; n++) {
+    min = -1;
+    for(i = 0; i < NITEMS; i++) {
+      if(shares[i] == 0)
+        continue;
+      if(min < 0 || PASS_LESS_THAN(pass[i], pass[min]))
+        min = i;
+    }
+    pass[min] += stride[min];
+  }
+  *elapsed = uptime() - start_tick;
+  return 0;
+}
+
+static void
+report(const char *name, int elapsed, int overflows)
+{
+  // A tick is 10ms, so ns per pick = elapsed * 10^7 / NPICKS
+  printf(1, "%s: %d ticks for %d picks, %d ns per pick, %d overflows\n", name,
+         elapsed, NPICKS, elapsed * (10000000 / NPICKS), overflows);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int elapsed, overflows;
+
+  overflows = bench_frac(&elapsed);
+  report("frac pass ", elapsed, overflows);
+
+  overflows = bench_fixed(&elapsed);
+  report("fixed pass", elapsed, overflows);
+
+  exit();
+}
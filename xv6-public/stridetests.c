@@ -1,11 +1,145 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "kstat.h"
 
 #define TESTCASE(N, cond)                                                      \
   printf(1, "Testcase #" #N ": ");                                             \
   printf(1, (cond) ? "correct\n" : "fail\n");
 
+#define CHURN_PROCS 64
+#define CHURN_WAVE 8
+
+#define MIX_IO_PROCS 2
+#define MIX_IO_SHARE 4
+#define MIX_CPU_SHARES 64 /* 80 - MIX_IO_PROCS * MIX_IO_SHARE - 8 (main) */
+#define MIX_MAX_CPU_PROCS 8
+#define MIX_LIFETIME 300
+#define MIX_UNIT 10000
+#define STRIDE_QUANTUM 5 /* STRIDE_MAX_TICKS */
+
+/*
+ * Churn n processes through set_cpu_share() and exit() in waves.
+ * Each child joins the stride queue, changes its share once and exits,
+ * so items keep getting inserted, adjusted and removed in the middle of
+ * the stride heap. Returns the number of children which failed.
+ */
+int
+churntest(int n)
+{
+  int fds[2], i, j, pid, failures = 0;
+  char c;
+
+  if(pipe(fds) < 0)
+    return -1;
+  for(i = 0; i < n; i += CHURN_WAVE) {
+    for(j = i; j < i + CHURN_WAVE && j < n; j++) {
+      if((pid = fork()) < 0)
+        return -1;
+      if(pid == 0) {
+        uint x = 0;
+        close(fds[0]);
+        c = (set_cpu_share(1 + j % 9) == 0 &&
+             set_cpu_share(1 + (j + 4) % 9) == 0) ? 'o' : 'x';
+        while(x++ < 10000000);
+        write(fds[1], &c, 1);
+        exit();
+      }
+    }
+    for(j = i; j < i + CHURN_WAVE && j < n; j++) {
+      wait();
+      if(read(fds[0], &c, 1) != 1 || c != 'o')
+        failures++;
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return failures;
+}
+
+/*
+ * Spin for MIX_LIFETIME ticks from start and return the work done in units.
+ * An I/O-bound worker sleeps one tick after every unit of work.
+ */
+static int
+mixworker(int share, int io, int start)
+{
+  int units = 0;
+  uint x;
+
+  if(set_cpu_share(share) != 0)
+    return -1;
+  while(uptime() < start)
+    sleep(1);
+  while(uptime() - start < MIX_LIFETIME) {
+    for(x = 0; x < MIX_UNIT; x++)
+      ;
+    units++;
+    if(io)
+      sleep(1);
+  }
+  return units;
+}
+
+/*
+ * Mix I/O-bound and CPU-bound stride processes. There are twice as many
+ * CPU-bound workers as cpus, so they compete, and half of them hold twice
+ * the share of the others: the heavy half must do about twice the work.
+ * The I/O-bound workers must get the cpu back at least once per two
+ * stride quanta after waking up, instead of being charged while asleep.
+ */
+int
+mixtest(void)
+{
+  struct kstat st;
+  int fds[2], i, pid, nbusy, unit_share, start, result[2];
+  int heavy = 0, light = 0, io_min = -1, failures = 0;
+
+  if(pipe(fds) < 0 || getkstat(&st) < 0)
+    return -1;
+  nbusy = 2 * st.ncpu < MIX_MAX_CPU_PROCS ? 2 * st.ncpu : MIX_MAX_CPU_PROCS;
+  unit_share = MIX_CPU_SHARES / (3 * nbusy / 2);
+  start = uptime() + 10;
+
+  for(i = 0; i < nbusy + MIX_IO_PROCS; i++) {
+    if((pid = fork()) < 0)
+      return -1;
+    if(pid == 0) {
+      close(fds[0]);
+      result[0] = i;
+      if(i < nbusy)
+        result[1] = mixworker(unit_share * (i % 2 ? 1 : 2), 0, start);
+      else
+        result[1] = mixworker(MIX_IO_SHARE, 1, start);
+      write(fds[1], result, sizeof result);
+      exit();
+    }
+  }
+  for(i = 0; i < nbusy + MIX_IO_PROCS; i++) {
+    wait();
+    if(read(fds[0], result, sizeof result) != sizeof result || result[1] < 0) {
+      failures++;
+      continue;
+    }
+    if(result[0] >= nbusy)
+      io_min = io_min < 0 || result[1] < io_min ? result[1] : io_min;
+    else if(result[0] % 2)
+      light += result[1];
+    else
+      heavy += result[1];
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  printf(1, "heavy %d units, light %d units, slowest I/O-bound %d rounds\n",
+         heavy, light, io_min);
+  if(light == 0 || heavy * 2 < light * 3 || heavy * 2 > light * 5)
+    failures++;
+  if(io_min < MIX_LIFETIME / (2 * STRIDE_QUANTUM))
+    failures++;
+  return failures;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -23,5 +157,8 @@ main(int argc, char *argv[])
   x = 0; while(x++ < 4000000000);
   printf(1, "Finished\n");
   TESTCASE(6, set_cpu_share(81) == -1);
+  TESTCASE(7, set_cpu_share(8) == 0);
+  TESTCASE(8, churntest(CHURN_PROCS) == 0);
+  TESTCASE(9, mixtest() == 0);
   exit();
 }
\ No newline at end of file
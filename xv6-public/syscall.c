@@ -78,6 +78,18 @@ argptr(int n, char **pp, int size)
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes that the kernel will write.
+// Like argptr(), but pages shared copy-on-write are copied first,
+// so running out of memory fails the call instead of the write.
+int
+argptrw(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  return cowbreak((uint)*pp, size);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -129,6 +141,17 @@ extern int sys_rwlock_release_readlock(void);
 extern int sys_rwlock_release_writelock(void);
 extern int sys_pread(void);
 extern int sys_pwrite(void);
+extern int sys_getkstat(void);
+extern int sys_set_sched_policy(void);
+extern int sys_sched_setaffinity(void);
+extern int sys_sched_getaffinity(void);
+extern int sys_thread_setaffinity(void);
+extern int sys_thread_getaffinity(void);
+extern int sys_futex(void);
+extern int sys_rwlock_setmode(void);
+extern int sys_lockbench(void);
+extern int sys_lockcycles(void);
+extern int sys_buddytest(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]                      sys_fork,
@@ -169,6 +192,17 @@ static int (*syscalls[])(void) = {
 [SYS_rwlock_release_writelock]  sys_rwlock_release_writelock,
 [SYS_pread]                     sys_pread,
 [SYS_pwrite]                    sys_pwrite,
+[SYS_getkstat]                  sys_getkstat,
+[SYS_set_sched_policy]          sys_set_sched_policy,
+[SYS_sched_setaffinity]         sys_sched_setaffinity,
+[SYS_sched_getaffinity]         sys_sched_getaffinity,
+[SYS_thread_setaffinity]        sys_thread_setaffinity,
+[SYS_thread_getaffinity]        sys_thread_getaffinity,
+[SYS_futex]                     sys_futex,
+[SYS_rwlock_setmode]            sys_rwlock_setmode,
+[SYS_lockbench]                 sys_lockbench,
+[SYS_lockcycles]                sys_lockcycles,
+[SYS_buddytest]                 sys_buddytest,
 };
 
 void
@@ -37,3 +37,14 @@
 #define SYS_rwlock_release_writelock   36
 #define SYS_pread                      37
 #define SYS_pwrite                     38
+#define SYS_getkstat                   39
+#define SYS_set_sched_policy           40
+#define SYS_sched_setaffinity          41
+#define SYS_sched_getaffinity          42
+#define SYS_thread_setaffinity         43
+#define SYS_thread_getaffinity         44
+#define SYS_futex                      45
+#define SYS_rwlock_setmode             46
+#define SYS_lockbench                  47
+#define SYS_lockcycles                 48
+#define SYS_buddytest                  49
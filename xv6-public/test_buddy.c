@@ -0,0 +1,49 @@
+/**
+ * This program stresses kalloc_pages()/kfree_pages() with blocks of mixed
+ * orders through the buddytest() system call, and prints the free buddy
+ * blocks per order before and after each run.
+ *
+ * buddytest() checks the alignment and contents of every block, and that
+ * freeing everything gives back as many free pages as before, so run it
+ * on an otherwise idle system.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define NRUNS 4
+#define ROUNDS 20000
+
+static void
+print_blocks(const char *title)
+{
+  struct kstat st;
+  uint order, nfree = 0;
+
+  getkstat(&st);
+  printf(1, "%s:", title);
+  for(order = 0; order < KSTAT_NORDER; order++) {
+    printf(1, " %d", st.buddy_free[order]);
+    nfree += st.buddy_free[order] << order;
+  }
+  printf(1, " (%d pages)\n", nfree);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, errors, failed = 0;
+
+  print_blocks("free blocks by order");
+  for(i = 0; i < NRUNS; i++) {
+    errors = buddytest(ROUNDS, 0x1234 + i * 7919);
+    printf(1, "run %d: %d rounds, %d errors\n", i, ROUNDS, errors);
+    if(errors != 0)
+      failed = 1;
+  }
+  print_blocks("free blocks by order");
+  printf(1, failed ? "FAIL\n" : "OK\n");
+  exit();
+}
@@ -0,0 +1,231 @@
+/**
+ * This program checks that fork() shares memory copy-on-write correctly.
+ *
+ * 1. Writes by the child after fork() stay in the child, and writes by
+ *    the parent stay in the parent.
+ * 2. The kernel writing into shared memory for the child, here read()
+ *    from a pipe, does not show through in the parent.
+ * 3. The stack of another lwp is copied too: the child still sees what
+ *    the thread had on its stack at fork() while the thread changes it.
+ * 4. Many children writing to the same shared pages at once each get
+ *    their own copy, and the parent keeps its own.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NPAGES 16
+#define PGSIZE 4096
+#define NCHILDREN 8
+
+static char buf[NPAGES * PGSIZE];
+static volatile int *thread_var; // Lives on the stack of the thread
+static volatile int thread_go, thread_done;
+static int go[2]; // The parent tells the child of 3. to look
+
+static void
+fill(char c)
+{
+  int i;
+
+  for(i = 0; i < sizeof buf; i++)
+    buf[i] = c;
+}
+
+static int
+check(char c)
+{
+  int i;
+
+  for(i = 0; i < sizeof buf; i++)
+    if(buf[i] != c)
+      return -1;
+  return 0;
+}
+
+// Fork a child running f, which reports back 'y' for success on a pipe.
+static int
+run_child(int (*f)(void))
+{
+  int fds[2], pid;
+  char c = 0;
+
+  if(pipe(fds) < 0)
+    return -1;
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0) {
+    close(fds[0]);
+    c = f() == 0 ? 'y' : 'n';
+    write(fds[1], &c, 1);
+    exit();
+  }
+  close(fds[1]);
+  read(fds[0], &c, 1);
+  close(fds[0]);
+  wait();
+  return c == 'y' ? 0 : -1;
+}
+
+static int
+child_write(void)
+{
+  if(check('a') < 0)
+    return -1;
+  fill('b');
+  return check('b');
+}
+
+static int
+child_read(void)
+{
+  int fds[2], i;
+
+  if(pipe(fds) < 0)
+    return -1;
+  for(i = 0; i < NPAGES; i++) {
+    write(fds[1], "c", 1);
+    if(read(fds[0], buf + i * PGSIZE, 1) != 1)
+      return -1;
+  }
+  for(i = 0; i < NPAGES; i++)
+    if(buf[i * PGSIZE] != 'c' || buf[i * PGSIZE + 1] != 'a')
+      return -1;
+  return 0;
+}
+
+static int
+child_thread_stack(void)
+{
+  char c;
+
+  // The thread does not run in this copy; wait until it wrote in the parent
+  if(read(go[0], &c, 1) != 1)
+    return -1;
+  return *thread_var == 1 ? 0 : -1;
+}
+
+void *
+thread_main(void *arg)
+{
+  volatile int local = 1;
+
+  thread_var = &local;
+  while(!thread_go)
+    yield();
+  local = 2;
+  thread_done = 1;
+  while(thread_go != 2)
+    yield();
+  thread_exit((void*)local);
+  return 0;
+}
+
+static int
+child_hammer(void)
+{
+  int pid = getpid(), i, round;
+
+  for(round = 0; round < 10; round++) {
+    for(i = 0; i < sizeof buf; i += 64)
+      ((int*)buf)[i / 4] = pid + round;
+    for(i = 0; i < sizeof buf; i += 64)
+      if(((int*)buf)[i / 4] != pid + round)
+        return -1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t;
+  void *ret;
+  int fds[2], i, pid, failed = 0;
+  char c;
+
+  printf(1, "1. writes after fork stay in their process\n");
+  fill('a');
+  if(run_child(child_write) < 0 || check('a') < 0) {
+    printf(1, "FAIL : child write\n");
+    failed = 1;
+  }
+
+  printf(1, "2. kernel writes for the child stay in the child\n");
+  if(run_child(child_read) < 0 || buf[0] != 'a' || check('a') < 0) {
+    printf(1, "FAIL : read into shared memory\n");
+    failed = 1;
+  }
+
+  printf(1, "3. lwp stacks are copied on write\n");
+  if(thread_create(&t, thread_main, 0) != 0) {
+    printf(1, "FAIL : thread_create\n");
+    exit();
+  }
+  while(thread_var == 0)
+    yield();
+  if(pipe(go) < 0 || pipe(fds) < 0 || (pid = fork()) < 0) {
+    printf(1, "FAIL : fork\n");
+    exit();
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    c = child_thread_stack() == 0 ? 'y' : 'n';
+    write(fds[1], &c, 1);
+    exit();
+  }
+  close(fds[1]);
+  thread_go = 1;
+  while(!thread_done)
+    yield();
+  write(go[1], "x", 1);
+  if(read(fds[0], &c, 1) != 1 || c != 'y') {
+    printf(1, "FAIL : child saw the thread's later write\n");
+    failed = 1;
+  }
+  close(fds[0]);
+  close(go[0]);
+  close(go[1]);
+  wait();
+  thread_go = 2;
+  if(thread_join(t, &ret) != 0 || (int)ret != 2) {
+    printf(1, "FAIL : thread lost its own write\n");
+    failed = 1;
+  }
+
+  printf(1, "4. %d children write the same pages at once\n", NCHILDREN);
+  fill('a');
+  if(pipe(fds) < 0) {
+    printf(1, "pipe failure\n");
+    exit();
+  }
+  for(i = 0; i < NCHILDREN; i++) {
+    if((pid = fork()) < 0) {
+      printf(1, "FAIL : fork\n");
+      exit();
+    }
+    if(pid == 0) {
+      close(fds[0]);
+      c = child_hammer() == 0 ? 'y' : 'n';
+      write(fds[1], &c, 1);
+      exit();
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < NCHILDREN; i++) {
+    if(read(fds[0], &c, 1) != 1 || c != 'y') {
+      printf(1, "FAIL : a child lost its writes\n");
+      failed = 1;
+    }
+    wait();
+  }
+  close(fds[0]);
+  if(check('a') < 0) {
+    printf(1, "FAIL : parent saw writes of its children\n");
+    failed = 1;
+  }
+
+  printf(1, failed ? "FAIL\n" : "OK\n");
+  exit();
+}
@@ -0,0 +1,104 @@
+/**
+ * This program checks futex() with 60 lwps hammering one counter.
+ *
+ * The counter is protected by the mutex of "Futexes Are Tricky": the word
+ * is 0 when unlocked, 1 when locked and 2 when locked with waiters. The
+ * fast paths never enter the kernel; contended lwps sleep in FUTEX_WAIT and
+ * the unlocker wakes one of them with FUTEX_WAKE. Lost updates or a hang
+ * mean the kernel dropped a wakeup or let a waiter sleep on a stale value.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "futex.h"
+
+#define NTHREADS 60
+#define NITERS 2000
+
+static volatile int mutex;
+static volatile int counter;
+static volatile int nwaits; // FUTEX_WAIT calls made by the slow path
+
+static void
+mutex_lock(volatile int *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(m, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(m, 2);
+  while(c != 0) {
+    __sync_fetch_and_add(&nwaits, 1);
+    futex((int*)m, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(m, 2);
+  }
+}
+
+static void
+mutex_unlock(volatile int *m)
+{
+  if(__sync_fetch_and_sub(m, 1) != 1) {
+    *m = 0;
+    futex((int*)m, FUTEX_WAKE, 1);
+  }
+}
+
+void *
+worker(void *arg)
+{
+  int i, j, v;
+
+  for(i = 0; i < NITERS; i++) {
+    mutex_lock(&mutex);
+    v = counter;
+    for(j = 0; j < 50; j++) // Widen the critical section
+      asm volatile("" ::: "memory");
+    counter = v + 1;
+    mutex_unlock(&mutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int i, word = 7;
+
+  printf(1, "1. FUTEX_WAIT returns at once on a stale value\n");
+  if(futex(&word, FUTEX_WAIT, 8) != -1) {
+    printf(1, "FAIL : futex wait on a stale value\n");
+    exit();
+  }
+  if(futex(&word, FUTEX_WAKE, 1) != 0) {
+    printf(1, "FAIL : futex wake without waiters\n");
+    exit();
+  }
+  if(futex((int*)((char*)&word + 1), FUTEX_WAIT, 7) != -1) {
+    printf(1, "FAIL : futex wait on a misaligned word\n");
+    exit();
+  }
+  printf(1, "OK\n");
+
+  printf(1, "2. %d lwps increment a counter under a futex mutex\n", NTHREADS);
+  for(i = 0; i < NTHREADS; i++) {
+    if(thread_create(&t[i], worker, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREADS; i++) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "counter %d of %d, %d futex waits\n", counter, NTHREADS * NITERS,
+         nwaits);
+  printf(1, counter == NTHREADS * NITERS && mutex == 0 ? "OK\n" : "FAIL\n");
+  exit();
+}
@@ -1,6 +1,7 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "kstat.h"
 
 #define NUM_THREAD 10
 
@@ -46,6 +47,9 @@ int lwpinlwptest(void);
 // Test behavior when a lwp is created recursively in a lwp
 int recursivelwptest(void);
 
+// Test that lwps of one process run in parallel on different cpus
+int paralleltest(void);
+
 volatile int gcnt;
 int gpipe[2];
 
@@ -70,6 +74,7 @@ struct {
   MAKE_TEST(sleeptest),
   MAKE_TEST(stridetest),
   MAKE_TEST(lwpinlwptest),
+  MAKE_TEST(paralleltest),
   // MAKE_TEST(recursivelwptest), // Not properly implemented
 };
 
@@ -780,4 +785,81 @@ recursivelwptest(void)
   return 0;
 }
 
-// ============================================================================
\ No newline at end of file
+// ============================================================================
+
+// ============================================================================
+
+#define PARALLEL_WORK 400000000
+#define PARALLEL_MAX 4
+
+void*
+parallelthreadmain(void *arg)
+{
+  volatile int i;
+
+  for (i = 0; i < (int)arg; i++);
+  thread_exit(arg);
+
+  return 0;
+}
+
+// Split PARALLEL_WORK iterations over n lwps and return the ticks it took
+int
+parallelrun(int n)
+{
+  thread_t threads[PARALLEL_MAX];
+  int i, start, done = 0;
+  void *retval;
+
+  start = uptime();
+  for (i = 0; i < n; i++){
+    if (thread_create(&threads[i], parallelthreadmain,
+                      (void*)(PARALLEL_WORK / n)) != 0){
+      printf(1, "panic at thread_create\n");
+      return -1;
+    }
+  }
+  for (i = 0; i < n; i++){
+    if (thread_join(threads[i], &retval) != 0){
+      printf(1, "panic at thread_join\n");
+      return -1;
+    }
+    done += (int)retval;
+  }
+  if (done != PARALLEL_WORK / n * n){
+    printf(1, "panic at validation in paralleltest : %d\n", done);
+    return -1;
+  }
+  return uptime() - start;
+}
+
+// With n lwps on at least n cpus the same work must take about 1/n of the
+// time. Run with CPUS=4 to see the speedup up to 4 lwps.
+int
+paralleltest(void)
+{
+  struct kstat ks;
+  int n, base, ticks, speedup;
+
+  if (getkstat(&ks) < 0){
+    printf(1, "panic at getkstat\n");
+    return -1;
+  }
+  if ((base = parallelrun(1)) <= 0)
+    return -1;
+  printf(1, "1 lwp : %d ticks\n", base);
+
+  for (n = 2; n <= PARALLEL_MAX; n *= 2){
+    if ((ticks = parallelrun(n)) < 0)
+      return -1;
+    speedup = base * 100 / (ticks > 0 ? ticks : 1);
+    printf(1, "%d lwps : %d ticks, speedup %d.%d%d\n", n, ticks,
+           speedup / 100, speedup / 10 % 10, speedup % 10);
+    // Near-linear: at least 3/4 of n while there is a cpu for every lwp
+    if (n <= ks.ncpu && speedup < n * 75){
+      printf(1, "panic at speedup with %d lwps on %d cpus\n", n, ks.ncpu);
+      return -1;
+    }
+  }
+  return 0;
+}
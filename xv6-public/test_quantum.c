@@ -0,0 +1,91 @@
+/**
+ * This program checks that every process gets exactly its configured
+ * time quantum while all CPUs are busy. Run it with CPUS=4 or more.
+ *
+ * Each worker joins the stride queue and spins on uptime(). A gap between
+ * two consecutive readings means the worker was descheduled, so the span of
+ * ticks seen without a gap is the length of one time slice. A slice must
+ * last STRIDE_QUANTUM ticks, or a multiple of it when the scheduler picks
+ * the same worker again right away, within one tick of measurement error.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWORKERS 8
+#define SHARE 8
+#define LIFETIME 500
+#define STRIDE_QUANTUM 5 /* STRIDE_MAX_TICKS */
+
+static int
+is_exact(int len)
+{
+  int r = len % STRIDE_QUANTUM;
+  return len >= STRIDE_QUANTUM - 1 && (r <= 1 || r >= STRIDE_QUANTUM - 1);
+}
+
+void
+worker(int id, int pipe)
+{
+  int start, now, last, run_start;
+  int result[2] = {0, 0}; /* slices, exact slices */
+
+  if(set_cpu_share(SHARE) != 0) {
+    printf(1, "FAIL : set_cpu_share\n");
+    write(pipe, result, sizeof result);
+    return;
+  }
+
+  start = last = run_start = uptime();
+  while((now = uptime()) - start < LIFETIME) {
+    if(now - last > 1) {
+      /* The first slice may have started before we measured it */
+      if(run_start != start) {
+        result[0]++;
+        result[1] += is_exact(last - run_start);
+      }
+      run_start = now;
+    }
+    last = now;
+  }
+
+  printf(1, "worker %d: %d slices, %d exact\n", id, result[0], result[1]);
+  write(pipe, result, sizeof result);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], i, pid;
+  int result[2], slices = 0, exact = 0;
+
+  if(pipe(fds) < 0) {
+    printf(1, "pipe failure\n");
+    exit();
+  }
+
+  for(i = 0; i < NWORKERS; i++) {
+    if((pid = fork()) < 0) {
+      printf(1, "FAIL : fork\n");
+      exit();
+    }
+    if(pid == 0) {
+      close(fds[0]);
+      worker(i, fds[1]);
+      exit();
+    }
+  }
+
+  for(i = 0; i < NWORKERS; i++) {
+    wait();
+    if(read(fds[0], result, sizeof result) == sizeof result) {
+      slices += result[0];
+      exact += result[1];
+    }
+  }
+
+  printf(1, "%d of %d slices lasted %d ticks\n", exact, slices, STRIDE_QUANTUM);
+  printf(1, slices > 0 && exact == slices ? "OK\n" : "FAIL\n");
+  exit();
+}
@@ -20,6 +20,8 @@ void * writer2_with_rwlock(void *arg);
 
 void test1(void);
 void test2(void);
+void test3(void);
+void test4(void);
 
 int
 main(int argc, char *argv[])
@@ -33,6 +35,12 @@ main(int argc, char *argv[])
   /* TEST for efficiency of reader performance of RW lock */
   test2();
 
+  /* TEST for the cost of a lock operation itself */
+  test3();
+
+  /* TEST for the fairness of each mode under the test_cio.c mix */
+  test4();
+
   exit();
 }
 
@@ -249,4 +257,176 @@ writer2_with_rwlock(void *arg)
 
   thread_exit(0);
   return 0;
-}
\ No newline at end of file
+}
+
+#define BENCH_OPS 20000
+
+umutex_t umutex;
+
+void *
+bench_readlock(void *arg)
+{
+  for(int rep = 0; rep < BENCH_OPS; ++rep) {
+    rwlock_acquire_readlock(&rwlock);
+    rwlock_release_readlock(&rwlock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+bench_writelock(void *arg)
+{
+  for(int rep = 0; rep < BENCH_OPS; ++rep) {
+    rwlock_acquire_writelock(&rwlock);
+    rwlock_release_writelock(&rwlock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+bench_umutex(void *arg)
+{
+  for(int rep = 0; rep < BENCH_OPS; ++rep) {
+    umutex_lock(&umutex);
+    umutex_unlock(&umutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Lock and unlock pairs per second of NTHREADS lwps running start_routine
+int
+bench(void *(*start_routine)(void *))
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int startTick = uptime(), elapsedTick;
+
+  for(int i = 0; i < NTHREADS; ++i) {
+    if(thread_create(&t[i], start_routine, (void *)(i)) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < NTHREADS; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  if((elapsedTick = uptime() - startTick) == 0)
+    elapsedTick = 1;
+  return NTHREADS * BENCH_OPS / elapsedTick * 100; // A tick is 10ms
+}
+
+void
+test3(void)
+{
+  int readOps, writeOps, mutexOps;
+
+  printf(1, "3. Lock Throughput Test\n");
+  readOps = bench(bench_readlock);
+  writeOps = bench(bench_writelock);
+  umutex_init(&umutex);
+  mutexOps = bench(bench_umutex);
+
+  printf(1, "\tRW lock read lock  %d ops/sec\n", readOps);
+  printf(1, "\tRW lock write lock %d ops/sec\n", writeOps);
+  printf(1, "\tuser-space mutex   %d ops/sec (%dx the write lock)\n", mutexOps, mutexOps / (writeOps ? writeOps : 1));
+}
+
+#define MIX_READERS 55
+#define MIX_WRITERS 5
+#define MIX_READS 200
+#define MIX_WRITES 40
+
+volatile int maxWriterWait;
+
+void *
+mix_reader(void *arg)
+{
+  int sum;
+
+  for(int rep = 0; rep < MIX_READS; ++rep) {
+    sum = 0;
+    rwlock_acquire_readlock(&rwlock);
+    for(int i = 0; i < 1000; ++i)
+      sum += data[i];
+    if(sum != data[0] * 1000)
+      printf(1, "Race detected\n");
+    rwlock_release_readlock(&rwlock);
+  }
+
+  thread_exit(0);
+  return 0;
+}
+
+void *
+mix_writer(void *arg)
+{
+  int id = (int)arg, waited, max;
+
+  for(int rep = 0; rep < MIX_WRITES; ++rep) {
+    int startTick = uptime();
+    rwlock_acquire_writelock(&rwlock);
+    waited = uptime() - startTick;
+    for(int i = 0; i < 1000; ++i)
+      data[i] = id + rep;
+    rwlock_release_writelock(&rwlock);
+    while((max = maxWriterWait) < waited &&
+          !__sync_bool_compare_and_swap(&maxWriterWait, max, waited))
+      ;
+  }
+
+  thread_exit(0);
+  return 0;
+}
+
+void
+test4(void)
+{
+  static const char *modes[] = {
+    [RWLOCK_PREFER_READER] "reader-preferring",
+    [RWLOCK_PREFER_WRITER] "writer-preferring",
+    [RWLOCK_PHASE_FAIR]    "phase-fair       ",
+  };
+  thread_t t[MIX_READERS + MIX_WRITERS];
+  void *ret;
+  int mode, startTick, elapsedTick;
+
+  printf(1, "4. %d Readers and %d Writers in each mode\n", MIX_READERS, MIX_WRITERS);
+  for(mode = 0; mode < 3; ++mode) {
+    rwlock_init(&rwlock);
+    if(rwlock_setmode(&rwlock, mode) < 0) {
+      printf(1, "panic at rwlock_setmode\n");
+      exit();
+    }
+    for(int i = 0; i < 1000; ++i)
+      data[i] = 0;
+    maxWriterWait = 0;
+
+    startTick = uptime();
+    for(int i = 0; i < MIX_READERS + MIX_WRITERS; ++i) {
+      void* (*start_routine)(void *) = i < MIX_WRITERS ? mix_writer : mix_reader;
+      if(thread_create(&t[i], start_routine, (void *)(i)) < 0) {
+        printf(1, "panic at thread create\n");
+        exit();
+      }
+    }
+    for(int i = 0; i < MIX_READERS + MIX_WRITERS; ++i) {
+      if(thread_join(t[i], &ret) < 0) {
+        printf(1, "panic at thread join\n");
+        exit();
+      }
+    }
+    if((elapsedTick = uptime() - startTick) == 0)
+      elapsedTick = 1;
+
+    printf(1, "\t%s %d ops/sec, worst writer wait %d ticks\n", modes[mode],
+           (MIX_READERS * MIX_READS + MIX_WRITERS * MIX_WRITES) * 100 / elapsedTick,
+           maxWriterWait);
+  }
+  rwlock_init(&rwlock);
+}
@@ -5,6 +5,7 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "sched.h"
 
 #define LIFETIME (1000)        /* (ticks) */
 #define COUNT_PERIOD (1000000) /* (iteration) */
@@ -12,6 +13,7 @@
 #define MLFQ_LEVEL (3) /* Number of level(priority) of MLFQ scheduler */
 #define MAX_NUM_PROCESSES                                                      \
   (10) /* Max number of processes to handle during processes */
+#define MAX_LATENCY (100) /* (ticks) Latencies above are counted as this */
 
 /**
  * This function requests portion of CPU resources with given parameter
@@ -120,13 +122,83 @@ test_mlfq(int type, int pipe)
   return;
 }
 
+/**
+ * This function gives up the CPU as soon as it gets scheduled.
+ * Every yield() makes one trip through the scheduler, so the reported cnt
+ * is the number of scheduler picks this process received during LIFETIME.
+ * Run the same workload with CPUS=1, 2, 4 and 8 to see how picks scale.
+ * The MLFQ queues are scanned and stolen from without ptable.lock; it is
+ * still taken once per pick to switch to the process.
+ */
+void
+test_picks(int unused, int pipe)
+{
+  int cnt = 0;
+  int start_tick;
+
+  /* Get start tick */
+  start_tick = uptime();
+
+  while(uptime() - start_tick <= LIFETIME) {
+    yield();
+    cnt++;
+  }
+
+  /* Report */
+  printf(1, "PICKS, cnt : %d, per second : %d\n", cnt, cnt / (LIFETIME / 100));
+  printf(pipe, "%d\n", cnt);
+
+  return;
+}
+
+/**
+ * This function measures the scheduling latency seen next to a workload.
+ * It sleeps one tick at a time; every tick beyond the one it asked for is
+ * time spent runnable but waiting for a CPU after the wakeup.
+ * It reports the 99th percentile and the maximum latency in ticks.
+ */
+void
+probe_latency(int unused, int pipe)
+{
+  static int hist[MAX_LATENCY + 1];
+  int start_tick, tick, lat, n = 0, seen = 0, p99 = 0, max = 0;
+
+  start_tick = uptime();
+  while((tick = uptime()) - start_tick <= LIFETIME) {
+    sleep(1);
+    lat = uptime() - tick - 1;
+    if(lat < 0)
+      lat = 0;
+    if(lat > MAX_LATENCY)
+      lat = MAX_LATENCY;
+    hist[lat]++;
+    n++;
+  }
+
+  for(lat = 0; lat <= MAX_LATENCY; lat++) {
+    if(hist[lat] == 0)
+      continue;
+    max = lat;
+    if(seen * 100 < n * 99)
+      p99 = lat;
+    seen += hist[lat];
+  }
+
+  printf(pipe, "%d %d\n", p99, max);
+}
+
 struct workload {
   void (*func)(int, int);
   int arg;
 };
 
-void
-dotest(struct workload *workloads)
+/**
+ * Runs the workloads concurrently and returns the sum of their cnt.
+ * If latency is not null, probe_latency() runs next to them and its
+ * 99th percentile and maximum are stored in latency[0] and latency[1].
+ */
+int
+dotest(struct workload *workloads, int *latency)
 {
   int pid;
   int i;
@@ -137,8 +209,8 @@ dotest(struct workload *workloads)
       ++p_workload) {
     ++size;
   }
-  int pipes[MAX_NUM_PROCESSES][2];
-  for(i = 0; i < size; ++i) {
+  int pipes[MAX_NUM_PROCESSES + 1][2];
+  for(i = 0; i < size + (latency != 0); ++i) {
     if(pipe(pipes[i]) < 0) {
       printf(1, "pipe failure");
       exit();
@@ -147,7 +219,7 @@ dotest(struct workload *workloads)
 
   int results[MAX_NUM_PROCESSES];
 
-  for(i = 0; i < size; i++) {
+  for(i = 0; i < size + (latency != 0); i++) {
     pid = fork();
     if(pid > 0) {
       close(pipes[i][1]);
@@ -155,8 +227,8 @@ dotest(struct workload *workloads)
       continue;
     } else if(pid == 0) {
       /* Child */
-      void (*func)(int, int) = workloads[i].func;
-      int arg = workloads[i].arg;
+      void (*func)(int, int) = i < size ? workloads[i].func : probe_latency;
+      int arg = i < size ? workloads[i].arg : 0;
       /* Do this workload */
       close(pipes[i][0]);
       func(arg, pipes[i][1]);
@@ -167,7 +239,7 @@ dotest(struct workload *workloads)
     }
   }
 
-  for(i = 0; i < size; i++) {
+  for(i = 0; i < size + (latency != 0); i++) {
     wait();
   }
 
@@ -179,9 +251,53 @@ dotest(struct workload *workloads)
     total += results[i];
   }
 
+  if(latency) {
+    char *s = buf;
+    read(pipes[size][0], buf, 999);
+    latency[0] = atoi(s);
+    while(*s && *s != ' ')
+      s++;
+    latency[1] = atoi(s);
+  }
+  for(i = 0; i < size + (latency != 0); ++i)
+    close(pipes[i][0]);
+
   printf(1, "Total: %d\n", total);
+  if(workloads[0].func == test_picks)
+    printf(1, "Picks per second: %d\n", total / (LIFETIME / 100));
 
-  exit();
+  return total;
+}
+
+/**
+ * Runs the same workload under every scheduling policy and reports
+ * the throughput (cnt per second) and the tail scheduling latency.
+ */
+void
+compare_policies(struct workload *workloads)
+{
+  static const char *names[NSCHED] = {
+      [SCHED_STRIDE] "stride", [SCHED_MLFQ] "mlfq", [SCHED_RR] "rr"};
+  int total[NSCHED], latency[NSCHED][2];
+  int policy, prev, orig = -1;
+
+  for(policy = 0; policy < NSCHED; policy++) {
+    printf(1, "== %s ==\n", names[policy]);
+    if((prev = set_sched_policy(policy)) < 0) {
+      printf(1, "FAIL : set_sched_policy\n");
+      exit();
+    }
+    if(orig < 0)
+      orig = prev;
+    total[policy] = dotest(workloads, latency[policy]);
+  }
+  set_sched_policy(orig);
+
+  printf(1, "policy   throughput(cnt/s)  p99 latency  max latency\n");
+  for(policy = 0; policy < NSCHED; policy++)
+    printf(1, "%s\t %d\t\t    %d ticks\t %d ticks\n", names[policy],
+           total[policy] / (LIFETIME / 100), latency[policy][0],
+           latency[policy][1]);
 }
 
 int
@@ -298,16 +414,29 @@ main(int argc, char *argv[])
           {test_stride, 45},
           {test_mlfq, MLFQ_NONE},
       },
+      {
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+          {test_picks, 0},
+      },
   };
 
-  if(argc != 2) {
+  if(argc != 2 && !(argc == 3 && strcmp(argv[2], "all") == 0)) {
     printf(1, "%d\n", argc);
-    printf(1, "test_scheduler num\n");
+    printf(1, "test_scheduler num [all]\n");
     exit();
   }
 
   int test = atoi(argv[1]);
 
-  dotest(workloads[test]);
+  if(argc == 3)
+    compare_policies(workloads[test]); /* Same workload under each policy */
+  else
+    dotest(workloads[test], 0);
   exit();
 }
@@ -1,6 +1,7 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "kstat.h"
 
 xem_t sem;
 
@@ -26,6 +27,103 @@ test_with_sem(void *arg)
   return 0;
 }
 
+#define NBENCH 4
+#define BENCH_OPS 20000
+
+usem_t usem;
+
+void *
+bench_xem(void *arg)
+{
+  for(int i = 0; i < BENCH_OPS; ++i) {
+    xem_wait(&sem);
+    xem_unlock(&sem);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+bench_usem(void *arg)
+{
+  for(int i = 0; i < BENCH_OPS; ++i) {
+    usem_wait(&usem);
+    usem_post(&usem);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Run NBENCH lwps taking and releasing a semaphore.
+// Returns the wait/post pairs per second.
+int
+bench(void *(*start_routine)(void *))
+{
+  thread_t t[NBENCH];
+  void *ret;
+  int start = uptime(), elapsed;
+
+  for(int i = 0; i < NBENCH; ++i) {
+    if(thread_create(&t[i], start_routine, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < NBENCH; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  if((elapsed = uptime() - start) == 0)
+    elapsed = 1;
+  return NBENCH * BENCH_OPS * 100 / elapsed; // A tick is 10ms
+}
+
+#define NCONTEND 60
+#define CONTEND_REPS 20
+
+void *
+contend_xem(void *arg)
+{
+  for(int i = 0; i < CONTEND_REPS; ++i) {
+    xem_wait(&sem);
+    for(volatile int n = 0; n < 10000; ++n) // Hold it for a while
+      ;
+    xem_unlock(&sem);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Context switches per xem_unlock() while NCONTEND lwps queue on sem,
+// in hundredths. A wake-all unlock makes every waiter run just to find
+// the unit gone and sleep again; a hand-off costs about one switch.
+int
+switches_per_unlock(void)
+{
+  thread_t t[NCONTEND];
+  struct kstat before, after;
+  void *ret;
+
+  xem_init(&sem);
+  getkstat(&before);
+  for(int i = 0; i < NCONTEND; ++i) {
+    if(thread_create(&t[i], contend_xem, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < NCONTEND; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  getkstat(&after);
+  return (after.nswtch - before.nswtch) * 100 / (NCONTEND * CONTEND_REPS);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -84,5 +182,18 @@ main(int argc, char *argv[])
     }
   }
   printf(1, "\nIts sequence could be messy\n");
+
+  printf(1, "4. Throughput of the kernel and the user-space semaphore\n");
+  int xem_ops, usem_ops;
+  xem_init(&sem);
+  xem_ops = bench(bench_xem);
+  usem_init(&usem, 1);
+  usem_ops = bench(bench_usem);
+  printf(1, "xem  %d ops/sec\n", xem_ops);
+  printf(1, "usem %d ops/sec (%dx)\n", usem_ops, usem_ops / (xem_ops ? xem_ops : 1));
+
+  printf(1, "5. Context switches per unlock with %d lwps waiting\n", NCONTEND);
+  int swtch = switches_per_unlock();
+  printf(1, "%d.%d%d switches per unlock\n", swtch / 100, swtch / 10 % 10, swtch % 10);
   exit();
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+/**
+ * This program checks the precision and the overhead of sleep().
+ *
+ * Precision: sleep(n) must return after n ticks, or n + 1 when the call
+ * started just before a tick.
+ *
+ * Overhead: NSLEEPERS lwps wake up every PERIOD ticks. Each of them should
+ * be switched to about once per period, rather than once per tick as when
+ * every sleeper was woken up to check its deadline.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define NSLEEPERS 40
+#define PERIOD 20
+#define DURATION 400
+
+static volatile int stop;
+
+static int
+precisiontest(void)
+{
+  static const int lens[] = {1, 2, 5, 10, 50, 100};
+  int i, start, elapsed, ok = 1;
+
+  for(i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    start = uptime();
+    sleep(lens[i]);
+    elapsed = uptime() - start;
+    printf(1, "sleep(%d): %d ticks\n", lens[i], elapsed);
+    if(elapsed < lens[i] || elapsed > lens[i] + 1)
+      ok = 0;
+  }
+  return ok;
+}
+
+void*
+periodicthread(void *arg)
+{
+  while(!stop)
+    sleep(PERIOD);
+  thread_exit(0);
+  return 0;
+}
+
+static int
+overheadtest(void)
+{
+  thread_t threads[NSLEEPERS];
+  struct kstat before, after;
+  void *retval;
+  int i, n, switches, expected;
+
+  for(n = 0; n < NSLEEPERS; n++) {
+    if(thread_create(&threads[n], periodicthread, 0) != 0) {
+      printf(1, "thread_create failed after %d lwps\n", n);
+      break;
+    }
+  }
+
+  getkstat(&before);
+  sleep(DURATION);
+  getkstat(&after);
+  stop = 1;
+  for(i = 0; i < n; i++)
+    thread_join(threads[i], &retval);
+
+  // One switch per period for each sleeper, plus some slack for the
+  // main lwp and the other processes in the system.
+  switches = after.nswtch - before.nswtch;
+  expected = n * DURATION / PERIOD;
+  printf(1, "%d sleepers, %d ticks: %d switches, %d expected\n", n,
+         after.ticks - before.ticks, switches, expected);
+  return switches <= 2 * expected + 100;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ok = 1;
+
+  if(!precisiontest()) {
+    printf(1, "FAIL : precision\n");
+    ok = 0;
+  }
+  if(!overheadtest()) {
+    printf(1, "FAIL : overhead\n");
+    ok = 0;
+  }
+  printf(1, ok ? "OK\n" : "FAIL\n");
+  exit();
+}
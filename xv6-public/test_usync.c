@@ -0,0 +1,175 @@
+/**
+ * This program checks the user-space mutex, condition variable and
+ * semaphore of usync.c under contention from many lwps.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NTHREADS 16
+#define NITERS 5000
+#define NITEMS 4000
+#define QSIZE 8
+#define NSLOTS 3
+
+umutex_t mutex;
+volatile int counter;
+
+ucond_t notfull, notempty;
+int queue[QSIZE];
+int qhead, qtail, qcount;
+volatile int consumed_sum;
+
+usem_t slots;
+volatile int inside, max_inside;
+
+void *
+mutex_worker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NITERS; i++) {
+    umutex_lock(&mutex);
+    counter++;
+    umutex_unlock(&mutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+producer(void *arg)
+{
+  int i, id = (int)arg;
+
+  // Producer id puts the items congruent to id
+  for(i = id + 1; i <= NITEMS; i += NTHREADS / 2) {
+    umutex_lock(&mutex);
+    while(qcount == QSIZE)
+      ucond_wait(&notfull, &mutex);
+    queue[qtail] = i;
+    qtail = (qtail + 1) % QSIZE;
+    qcount++;
+    ucond_signal(&notempty);
+    umutex_unlock(&mutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+consumer(void *arg)
+{
+  int item, sum = 0;
+
+  while(1) {
+    umutex_lock(&mutex);
+    while(qcount == 0)
+      ucond_wait(&notempty, &mutex);
+    item = queue[qhead];
+    qhead = (qhead + 1) % QSIZE;
+    qcount--;
+    ucond_signal(&notfull);
+    umutex_unlock(&mutex);
+    if(item == 0) // Poison pill
+      break;
+    sum += item;
+  }
+  __sync_fetch_and_add(&consumed_sum, sum);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+sem_worker(void *arg)
+{
+  int i, n;
+  volatile int spin;
+
+  for(i = 0; i < NITERS / 10; i++) {
+    usem_wait(&slots);
+    n = __sync_add_and_fetch(&inside, 1);
+    while((spin = max_inside) < n && !__sync_bool_compare_and_swap(&max_inside, spin, n))
+      ;
+    for(spin = 0; spin < 1000; spin++)
+      ;
+    __sync_fetch_and_sub(&inside, 1);
+    usem_post(&slots);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+static void
+run(void *(*start_routine)(void *), int n, int arg_is_id)
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int i;
+
+  for(i = 0; i < n; i++) {
+    if(thread_create(&t[i], start_routine, (void *)(arg_is_id ? i : 0)) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(i = 0; i < n; i++) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int i;
+
+  printf(1, "1. %d lwps increment a counter under a umutex\n", NTHREADS);
+  umutex_init(&mutex);
+  run(mutex_worker, NTHREADS, 0);
+  printf(1, "counter %d of %d\n", counter, NTHREADS * NITERS);
+  printf(1, counter == NTHREADS * NITERS && umutex_trylock(&mutex) == 0 ? "OK\n" : "FAIL\n");
+  umutex_unlock(&mutex);
+
+  printf(1, "2. Producers and consumers on a bounded queue with ucond\n");
+  ucond_init(&notfull);
+  ucond_init(&notempty);
+  for(i = 0; i < NTHREADS / 2; i++) {
+    if(thread_create(&t[i], consumer, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  run(producer, NTHREADS / 2, 1);
+  // One poison pill per consumer
+  for(i = 0; i < NTHREADS / 2; i++) {
+    umutex_lock(&mutex);
+    while(qcount == QSIZE)
+      ucond_wait(&notfull, &mutex);
+    queue[qtail] = 0;
+    qtail = (qtail + 1) % QSIZE;
+    qcount++;
+    ucond_broadcast(&notempty);
+    umutex_unlock(&mutex);
+  }
+  for(i = 0; i < NTHREADS / 2; i++) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "sum %d of %d\n", consumed_sum, NITEMS * (NITEMS + 1) / 2);
+  printf(1, consumed_sum == NITEMS * (NITEMS + 1) / 2 ? "OK\n" : "FAIL\n");
+
+  printf(1, "3. %d lwps share %d units of a usem\n", NTHREADS, NSLOTS);
+  usem_init(&slots, NSLOTS);
+  run(sem_worker, NTHREADS, 0);
+  printf(1, "at most %d lwps were inside\n", max_inside);
+  printf(1, max_inside <= NSLOTS && slots.count == NSLOTS ? "OK\n" : "FAIL\n");
+  exit();
+}
@@ -0,0 +1,150 @@
+// Timer wheel for sleep().
+//
+// Each lwp in sleep() is linked into one slot of a hierarchical timer
+// wheel keyed by the tick it must wake up at, so the timer interrupt only
+// wakes the lwps whose deadline has come instead of every sleeper.
+// Level 0 has one slot per tick for the next 64 ticks, level 1 one slot
+// per 64 ticks, and so on. Whenever the lower level wraps, the next slot
+// of the level above is cascaded down. Like the rest of sleep and wakeup,
+// the wheel is serialized by ptable.lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "lwp.h"
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+#define TW_MAX (1 << (TW_BITS * TW_LEVELS)) // Ticks the wheel can hold
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+static struct lwp *wheel[TW_LEVELS][TW_SIZE];
+static uint tw_next; // Next tick to process
+
+static void
+wheel_link(struct lwp **head, struct lwp *lwp)
+{
+  lwp->tm_pprev = head;
+  if((lwp->tm_next = *head) != 0)
+    (*head)->tm_pprev = &lwp->tm_next;
+  *head = lwp;
+}
+
+static void
+wheel_unlink(struct lwp *lwp)
+{
+  if(lwp->tm_pprev == 0)
+    return;
+  if((*lwp->tm_pprev = lwp->tm_next) != 0)
+    lwp->tm_next->tm_pprev = lwp->tm_pprev;
+  lwp->tm_next = 0;
+  lwp->tm_pprev = 0;
+}
+
+// Put lwp into the slot of lwp->tm_expire relative to tw_next
+static void
+wheel_add(struct lwp *lwp)
+{
+  uint expire = lwp->tm_expire, delta = expire - tw_next;
+  int lev;
+
+  if((int)delta < 0) {
+    // Already due: take the slot processed next
+    wheel_link(&wheel[0][tw_next & TW_MASK], lwp);
+    return;
+  }
+  if(delta >= TW_MAX) {
+    // Park it at the far end; it is placed again when it cascades down
+    delta = TW_MAX - 1;
+    expire = tw_next + delta;
+  }
+  for(lev = 0; lev < TW_LEVELS - 1 && delta >= 1 << (TW_BITS * (lev + 1));)
+    lev++;
+  wheel_link(&wheel[lev][(expire >> (TW_BITS * lev)) & TW_MASK], lwp);
+}
+
+// Move the lwps of the current slot of level lev down the wheel.
+// Returns the index of that slot.
+static int
+cascade(int lev)
+{
+  int idx = (tw_next >> (TW_BITS * lev)) & TW_MASK;
+  struct lwp *lwp, *next;
+
+  lwp = wheel[lev][idx];
+  wheel[lev][idx] = 0;
+  for(; lwp != 0; lwp = next) {
+    next = lwp->tm_next;
+    wheel_add(lwp);
+  }
+  return idx;
+}
+
+// Called by the timer interrupt after ticks reached now.
+// Wakes every lwp whose deadline is due.
+void
+timer_expire(uint now)
+{
+  struct lwp *lwp, *next;
+  int idx, lev;
+
+  acquire(&ptable.lock);
+  while((int)(now - tw_next) >= 0) {
+    idx = tw_next & TW_MASK;
+    if(idx == 0)
+      for(lev = 1; lev < TW_LEVELS && cascade(lev) == 0; lev++)
+        ;
+    lwp = wheel[0][idx];
+    wheel[0][idx] = 0;
+    tw_next++;
+    for(; lwp != 0; lwp = next) {
+      next = lwp->tm_next;
+      lwp->tm_next = 0;
+      lwp->tm_pprev = 0;
+      if((int)(lwp->tm_expire - now) > 0) {
+        wheel_add(lwp); // Was parked at the far end
+        continue;
+      }
+      if(lwp->state == LWP_SLEEPING && lwp->chan == &lwp->tm_expire) {
+        waitq_remove(lwp);
+        wakeup_lwp(lwp->wq_proc, lwp);
+      }
+    }
+  }
+  release(&ptable.lock);
+}
+
+// Sleep the current lwp for n ticks.
+// Returns -1 if the process was killed meanwhile.
+int
+timer_sleep(uint n)
+{
+  struct proc *p = myproc();
+  struct lwp *lwp = mylwp(p);
+  int ret = 0;
+
+  if(n == 0)
+    return 0;
+  acquire(&ptable.lock);
+  lwp->tm_expire = ticks + n;
+  wheel_add(lwp);
+  while(lwp->tm_pprev != 0) {
+    if(p->killed) {
+      wheel_unlink(lwp);
+      ret = -1;
+      break;
+    }
+    sleep(&lwp->tm_expire, &ptable.lock);
+  }
+  release(&ptable.lock);
+  return ret;
+}
@@ -7,13 +7,14 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "seqlock.h"
 #include "schedulers.h"
 #include "lwp.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
-struct spinlock tickslock;
+struct seqlock tickslock;
 uint ticks;
 
 void
@@ -25,7 +26,20 @@ tvinit(void)
     SETGATE(idt[i], 0, SEG_KCODE<<3, vectors[i], 0);
   SETGATE(idt[T_SYSCALL], 1, SEG_KCODE<<3, vectors[T_SYSCALL], DPL_USER);
 
-  initlock(&tickslock, "time");
+  initseqlock(&tickslock, "time");
+}
+
+// Ticks since boot. Readers of the clock never contend with each other.
+uint
+getticks(void)
+{
+  uint seq, xticks;
+
+  do {
+    seq = read_seqbegin(&tickslock);
+    xticks = ticks;
+  } while(read_seqretry(&tickslock, seq));
+  return xticks;
 }
 
 void
@@ -39,11 +53,11 @@ void
 trap(struct trapframe *tf)
 {
   if(tf->trapno == T_SYSCALL){
-    if(myproc()->killed)
+    if(myproc()->killed || myproc()->lwp_reaper)
       exit();
     mylwp(myproc())->tf = tf;
     syscall();
-    if(myproc()->killed)
+    if(myproc()->killed || myproc()->lwp_reaper)
       exit();
     return;
   }
@@ -51,10 +65,10 @@ trap(struct trapframe *tf)
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
-      acquire(&tickslock);
+      write_seqlock(&tickslock);
       ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
+      write_sequnlock(&tickslock);
+      timer_expire(ticks);
     }
     lapiceoi();
     break;
@@ -73,12 +87,30 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Only wakes a halted scheduler; it rescans the queues by itself.
+    mycpu()->nipi++;
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLB:
+    // Another cpu unmapped pages of the process running here
+    tlbflush(mycpu());
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
             cpuid(), tf->cs, tf->eip);
     lapiceoi();
     break;
+  case T_PGFLT:
+    // A write to memory shared copy-on-write since fork(), either by
+    // the process or by the kernel on its behalf
+    if((tf->err & FEC_WR) && cowfault(rcr2()) == 0)
+      break;
+    if((tf->err & FEC_WR) && (tf->cs&3) == 0 && cowsink(rcr2()) == 0)
+      break;
+    // fall through
 
   //PAGEBREAK: 13
   default:
@@ -99,27 +131,22 @@ trap(struct trapframe *tf)
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
   // until it gets to the regular system call return.)
-  if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
+  // The lwps of a process which exits or execs retire the same way.
+  if(myproc() && (myproc()->killed || myproc()->lwp_reaper) &&
+     (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force the lwp to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
+  if(myproc() && mylwp(myproc())->state == LWP_RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER){
-    if(stride_has_to_yield(myproc()) ||
-       (is_mlfq(myproc()) && mlfq_has_to_yield(myproc()))) {
+    if(sched_has_to_yield(myproc()) ||
+       !lwp_allowed(myproc(), mylwp(myproc()), mycpu()))
       yield();
-    }
-
-    // Find another runnable lwp except the current lwp
-    struct lwp** next_lwp = get_runnable_lwp(myproc());
-    if(next_lwp != 0 && next_lwp != mylwp1(myproc())){
-      mylwp(myproc())->state = LWP_RUNNABLE;
-      swtchlwp(next_lwp);
-    }
   }
 
   // Check if the process has been killed since we yielded
-  if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
+  if(myproc() && (myproc()->killed || myproc()->lwp_reaper) &&
+     (tf->cs&3) == DPL_USER)
     exit();
 }
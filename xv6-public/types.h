@@ -9,3 +9,4 @@ typedef struct xem_t xem_t;
 typedef struct rwlock_t rwlock_t;
 #include "uio.h"
 typedef struct ts_guard thread_safe_guard;
+#include "usync.h"
@@ -1,4 +1,5 @@
 struct stat;
+struct kstat;
 struct rtcdate;
 
 // system calls
@@ -62,7 +63,29 @@ int rwlock_acquire_readlock(rwlock_t *rwlock);
 int rwlock_acquire_writelock(rwlock_t *rwlock);
 int rwlock_release_readlock(rwlock_t *rwlock);
 int rwlock_release_writelock(rwlock_t *rwlock);
+int rwlock_setmode(rwlock_t *rwlock, int mode);
 
 // sysfile.c
 int pread(int, void*, int, int);
 int pwrite(int, const void*, int, int);
+
+// impl_getkstat.c
+int getkstat(struct kstat*);
+
+// impl_set_sched_policy.c
+int set_sched_policy(int);
+
+// impl_sched_affinity.c
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int thread_setaffinity(thread_t, uint);
+int thread_getaffinity(thread_t);
+
+// impl_futex.c
+int futex(int*, int, int);
+
+// impl_lockbench.c
+int lockbench(int, int);
+int lockcycles(int, int);
+// impl_buddytest.c
+int buddytest(int, uint);
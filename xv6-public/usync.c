@@ -0,0 +1,172 @@
+// User-space synchronization on top of futex().
+//
+// The mutex is the three-state one of "Futexes Are Tricky": a locker
+// which finds it held marks it contended (2) before sleeping, so the
+// unlocker only calls FUTEX_WAKE when somebody may be asleep. The
+// condition variable and the semaphore count their sleepers for the
+// same reason. Every locked instruction is a full barrier on x86, which
+// is what makes checking the waiter counts after the update safe.
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "futex.h"
+
+#define WAKE_ALL 0x7fffffff
+
+void
+umutex_init(umutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+umutex_lock(umutex_t *m)
+{
+  uint c;
+
+  if((c = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0) {
+    futex((int*)&m->state, FUTEX_WAIT, 2);
+    c = xchg(&m->state, 2);
+  }
+}
+
+// Returns 0 if the mutex was taken, -1 if it is held.
+int
+umutex_trylock(umutex_t *m)
+{
+  return cmpxchg(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_unlock(umutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1) {
+    m->state = 0;
+    futex((int*)&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+void
+ucond_init(ucond_t *cv)
+{
+  cv->seq = 0;
+  cv->nwaiters = 0;
+}
+
+// Release m, wait for a signal and take m again.
+// As usual, the caller has to check its condition again.
+void
+ucond_wait(ucond_t *cv, umutex_t *m)
+{
+  uint seq;
+
+  __sync_fetch_and_add(&cv->nwaiters, 1);
+  seq = cv->seq;
+  umutex_unlock(m);
+  // Returns at once if a signal bumped seq after we read it
+  futex((int*)&cv->seq, FUTEX_WAIT, seq);
+  __sync_fetch_and_sub(&cv->nwaiters, 1);
+  umutex_lock(m);
+}
+
+void
+ucond_signal(ucond_t *cv)
+{
+  __sync_fetch_and_add(&cv->seq, 1);
+  if(cv->nwaiters > 0)
+    futex((int*)&cv->seq, FUTEX_WAKE, 1);
+}
+
+void
+ucond_broadcast(ucond_t *cv)
+{
+  __sync_fetch_and_add(&cv->seq, 1);
+  if(cv->nwaiters > 0)
+    futex((int*)&cv->seq, FUTEX_WAKE, WAKE_ALL);
+}
+
+void
+usem_init(usem_t *s, int count)
+{
+  s->count = count;
+  s->nwaiters = 0;
+}
+
+// Returns 0 if a unit was taken, -1 if none is available.
+int
+usem_trywait(usem_t *s)
+{
+  uint c;
+
+  while((c = s->count) > 0)
+    if(cmpxchg(&s->count, c, c - 1) == c)
+      return 0;
+  return -1;
+}
+
+void
+usem_wait(usem_t *s)
+{
+  while(usem_trywait(s) < 0) {
+    __sync_fetch_and_add(&s->nwaiters, 1);
+    futex((int*)&s->count, FUTEX_WAIT, 0);
+    __sync_fetch_and_sub(&s->nwaiters, 1);
+  }
+}
+
+void
+usem_post(usem_t *s)
+{
+  __sync_fetch_and_add(&s->count, 1);
+  if(s->nwaiters > 0)
+    futex((int*)&s->count, FUTEX_WAKE, 1);
+}
+
+void
+useqlock_init(useqlock_t *sl)
+{
+  sl->seq = 0;
+  umutex_init(&sl->wlock);
+}
+
+void
+useqlock_write_lock(useqlock_t *sl)
+{
+  umutex_lock(&sl->wlock);
+  sl->seq++;
+  asm volatile("" ::: "memory");
+}
+
+void
+useqlock_write_unlock(useqlock_t *sl)
+{
+  asm volatile("" ::: "memory");
+  sl->seq++;
+  umutex_unlock(&sl->wlock);
+}
+
+// Copy the data between useqlock_read_begin() and useqlock_read_retry()
+// and start over while the latter returns 1. x86 keeps loads in order,
+// so only the compiler needs a barrier.
+uint
+useqlock_read_begin(useqlock_t *sl)
+{
+  uint seq;
+
+  while((seq = sl->seq) & 1)
+    ;
+  asm volatile("" ::: "memory");
+  return seq;
+}
+
+int
+useqlock_read_retry(useqlock_t *sl, uint seq)
+{
+  asm volatile("" ::: "memory");
+  return sl->seq != seq;
+}
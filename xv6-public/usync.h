@@ -0,0 +1,47 @@
+#pragma once
+
+// User-space mutexes, condition variables and semaphores.
+// The uncontended paths are a single locked instruction; only an lwp
+// which has to wait enters the kernel, through futex().
+
+typedef struct umutex {
+  volatile uint state; // 0 unlocked, 1 locked, 2 locked with waiters
+} umutex_t;
+
+typedef struct ucond {
+  volatile uint seq;      // Bumped by every signal and broadcast
+  volatile uint nwaiters; // Lwps in ucond_wait()
+} ucond_t;
+
+typedef struct usem {
+  volatile uint count;    // Units available
+  volatile uint nwaiters; // Lwps sleeping in usem_wait()
+} usem_t;
+
+// Sequence lock for data shared by the lwps of a process.
+// Readers never write to it; see useqlock_read_begin().
+typedef struct useqlock {
+  volatile uint seq; // Odd while a writer is inside
+  umutex_t wlock;    // Serializes the writers
+} useqlock_t;
+
+void umutex_init(umutex_t *m);
+void umutex_lock(umutex_t *m);
+int umutex_trylock(umutex_t *m);
+void umutex_unlock(umutex_t *m);
+
+void ucond_init(ucond_t *cv);
+void ucond_wait(ucond_t *cv, umutex_t *m);
+void ucond_signal(ucond_t *cv);
+void ucond_broadcast(ucond_t *cv);
+
+void usem_init(usem_t *s, int count);
+void usem_wait(usem_t *s);
+int usem_trywait(usem_t *s);
+void usem_post(usem_t *s);
+
+void useqlock_init(useqlock_t *sl);
+void useqlock_write_lock(useqlock_t *sl);
+void useqlock_write_unlock(useqlock_t *sl);
+uint useqlock_read_begin(useqlock_t *sl);
+int useqlock_read_retry(useqlock_t *sl, uint seq);
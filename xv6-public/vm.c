@@ -5,11 +5,20 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Serializes copy-on-write sharing by copyuvm() with its undoing by
+// cowfault(), so a page's users are counted right while its PTEs change.
+struct spinlock cowlock;
+
+// Stands in for a copy-on-write page the kernel must write to when
+// there is no memory to copy it into; see cowsink().
+static char *sinkpage;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -21,12 +30,17 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  c = lapiccpu();
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Per-cpu data for mycpu() and myproc()
+  c->gdt[SEG_KCPU] = SEG(STA_W, c, sizeof(*c) - 1, 0);
   lgdt(c->gdt, sizeof(c->gdt));
+  c->self = c;
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -42,10 +56,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -121,9 +134,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -140,6 +152,9 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
+  initlock(&cowlock, "cow");
+  if((sinkpage = kalloc()) == 0)
+    panic("kvmalloc");
   kpgdir = setupkvm();
   switchkvm();
 }
@@ -188,8 +203,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -234,13 +248,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -281,6 +294,47 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Like deallocuvm(), but only unmap the pages: each frame stays in its
+// PTE, which is no longer present, until freeuvm() frees it. Other cpus
+// running lwps of the process may still reach the pages through stale
+// TLB entries, so the caller shoots those down in between.
+int
+unmapuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  pte_t *pte;
+  uint a;
+
+  if(newsz >= oldsz)
+    return oldsz;
+
+  for(a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else
+      *pte &= ~PTE_P;
+  }
+  return newsz;
+}
+
+// Free the frames which unmapuvm() left between newsz and oldsz.
+void
+freeuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if((*pte & PTE_P) == 0 && PTE_ADDR(*pte) != 0){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = 0;
+    }
+  }
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -313,61 +367,159 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the page at va of pgdir into d as well. A writable page becomes
+// read-only with PTE_COW in both, to be copied by cowfault() on the
+// first write. The caller must hold cowlock.
+static int
+cowshare(pde_t *pgdir, pde_t *d, uint va)
+{
+  pte_t *pte;
+  uint pa;
+
+  if((pte = walkpgdir(pgdir, (void *) va, 0)) == 0)
+    panic("copyuvm: pte should exist");
+  if(!(*pte & PTE_P))
+    panic("copyuvm: page not present");
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE_ADDR(*pte);
+  if(mappages(d, (void*)va, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+    return -1;
+  kdup(P2V(pa));
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The memory and the lwp stacks are shared
+// copy-on-write, so the caller must flush the TLBs of the parent.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz, struct lwp **lwps)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, l, i, flags;
-  char *mem;
+  uint l, i;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+  acquire(&cowlock);
+  for(i = 0; i < sz; i += PGSIZE)
+    if(cowshare(pgdir, d, i) < 0)
       goto bad;
-    }
-  }
   for(l = 0; l < NLWPS; ++l) {
     if(lwps[l] == 0)
       continue;
     uint stack_sz = lwps[l]->stack_sz;
     uint stack_base = stack_base_lwp(&lwps[l]);
-    for(i = PGROUNDDOWN(stack_base - stack_sz); i < stack_base; i += PGSIZE){
-      if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-        panic("copyuvm: pte should exist");
-      if(!(*pte & PTE_P))
-        panic("copyuvm: page not present");
-      pa = PTE_ADDR(*pte);
-      flags = PTE_FLAGS(*pte);
-      if((mem = kalloc()) == 0)
-        goto bad;
-      memmove(mem, (char*)P2V(pa), PGSIZE);
-      if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-        kfree(mem);
+    for(i = PGROUNDDOWN(stack_base - stack_sz); i < stack_base; i += PGSIZE)
+      if(cowshare(pgdir, d, i) < 0)
         goto bad;
-      }
-    }
   }
+  release(&cowlock);
   return d;
 
 bad:
+  release(&cowlock);
   freevm(d);
   return 0;
 }
 
+// Handle a write by the current process to its page at va: if the page
+// is shared copy-on-write, give the process its own copy, or just make
+// it writable again if nobody else uses it anymore.
+// Returns -1 if the write was not allowed after all.
+int
+cowfault(uint va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+  int moved = 0;
+
+  if(p == 0 || va >= KERNBASE)
+    return -1;
+  acquire(&cowlock);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW)){
+    // Another lwp of p may have got here first, and the fault
+    // dropped the stale TLB entry already
+    flags = pte ? *pte & (PTE_P|PTE_W|PTE_U) : 0;
+    release(&cowlock);
+    return flags == (PTE_P|PTE_W|PTE_U) ? 0 : -1;
+  }
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcount(P2V(pa)) == 1)
+    *pte = pa | flags; // The last user keeps the page
+  else {
+    if((mem = kalloc()) == 0){
+      release(&cowlock);
+      return -1;
+    }
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree((char*)P2V(pa));
+    moved = 1;
+  }
+  release(&cowlock);
+
+  invlpg((void*)va);
+  // Other lwps of p must not keep reading the page left to the others
+  if(moved)
+    tlbshootdown(p);
+  return 0;
+}
+
+// Copy the pages in [va, va+len) of the current process that are
+// shared copy-on-write, before the kernel writes to them.
+// Returns -1 if there is no memory for a copy.
+int
+cowbreak(uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(myproc()->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Handle a write by the kernel to a page at va of the current process
+// that cowfault() had no memory to copy. The page became copy-on-write
+// again after cowbreak() (a sibling lwp forked while the system call
+// slept), and the faulting write can't be failed, so it goes to the
+// sink page, mapped kernel-only, and the process is killed.
+// Returns -1 if va is not such a page.
+int
+cowsink(uint va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint pa;
+
+  if(p == 0 || va >= KERNBASE)
+    return -1;
+  acquire(&cowlock);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW) ||
+     krefcount(sinkpage) == 255){
+    release(&cowlock);
+    return -1;
+  }
+  pa = PTE_ADDR(*pte);
+  kdup(sinkpage);
+  *pte = V2P(sinkpage) | PTE_P | PTE_W;
+  kfree((char*)P2V(pa));
+  release(&cowlock);
+
+  invlpg((void*)va);
+  tlbshootdown(p);
+  p->killed = 1;
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -390,11 +542,17 @@ int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
+  pte_t *pte;
   uint n, va0;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Copy-on-write pages are only shared by a process which has run
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) &&
+       (myproc() == 0 || pgdir != myproc()->pgdir || cowfault(va0) < 0))
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -0,0 +1,69 @@
+// Wait channels.
+//
+// An lwp which sleeps on a channel is linked into the bucket the channel
+// hashes to, so wakeup() only looks at the lwps of that bucket instead of
+// every lwp slot of every process. All of it is serialized by ptable.lock,
+// which sleep() and wakeup() hold anyway.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "lwp.h"
+
+#define WAITQ_SHIFT 7
+#define NWAITQ (1 << WAITQ_SHIFT)
+
+static struct lwp *waitq[NWAITQ];
+uint waitq_nvisit; // Lwps looked at by wakeups, for getkstat()
+
+// Fibonacci hashing: channels are mostly aligned kernel addresses,
+// so take the high bits of the product rather than the low ones.
+static inline uint
+waitq_hash(void *chan)
+{
+  return ((uint)chan * 2654435761U) >> (32 - WAITQ_SHIFT);
+}
+
+// Link lwp of process p, which is about to sleep on lwp->chan.
+// The ptable lock must be held.
+void
+waitq_insert(struct proc *p, struct lwp *lwp)
+{
+  struct lwp **head = &waitq[waitq_hash(lwp->chan)];
+
+  lwp->wq_proc = p;
+  lwp->wq_pprev = head;
+  if((lwp->wq_next = *head) != 0)
+    (*head)->wq_pprev = &lwp->wq_next;
+  *head = lwp;
+}
+
+// Unlink lwp if it is still linked. The ptable lock must be held.
+void
+waitq_remove(struct lwp *lwp)
+{
+  if(lwp->wq_pprev == 0)
+    return;
+  if((*lwp->wq_pprev = lwp->wq_next) != 0)
+    lwp->wq_next->wq_pprev = lwp->wq_pprev;
+  lwp->wq_next = 0;
+  lwp->wq_pprev = 0;
+}
+
+// Wake up every lwp sleeping on chan. The ptable lock must be held.
+void
+waitq_wakeup(void *chan)
+{
+  struct lwp *lwp, *next;
+
+  for(lwp = waitq[waitq_hash(chan)]; lwp != 0; lwp = next){
+    next = lwp->wq_next;
+    waitq_nvisit++;
+    if(lwp->chan != chan || lwp->state != LWP_SLEEPING)
+      continue;
+    waitq_remove(lwp);
+    wakeup_lwp(lwp->wq_proc, lwp);
+  }
+}
@@ -0,0 +1,82 @@
+/**
+ * This program measures the cost of wakeup() while many lwps sleep.
+ * NIDLE lwps block on an empty pipe, then the main lwp passes one byte
+ * back and forth through another pipe NROUNDS times; every write and read
+ * calls wakeup() although nobody waits on that pipe. With hashed wait
+ * channels the idle lwps should not make those wakeups any slower.
+ * getkstat() reports how many sleeping lwps the wakeups looked at.
+ */
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define NIDLE 60
+#define NROUNDS 20000
+
+static int idle[2];
+
+void*
+idlethread(void *arg)
+{
+  char c;
+
+  read(idle[0], &c, 1); // Returns once the write end is closed
+  thread_exit(0);
+  return 0;
+}
+
+static void
+measure(int nidle)
+{
+  struct kstat before, after;
+  int fds[2], i;
+  char c = 'x';
+
+  if(pipe(fds) < 0) {
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  getkstat(&before);
+  for(i = 0; i < NROUNDS; i++) {
+    write(fds[1], &c, 1);
+    read(fds[0], &c, 1);
+  }
+  getkstat(&after);
+  close(fds[0]);
+  close(fds[1]);
+
+  printf(1, "%d idle lwps: %d ticks for %d wakeups, %d lwps visited\n",
+         nidle, after.ticks - before.ticks, 2 * NROUNDS,
+         after.wakeup_visits - before.wakeup_visits);
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t threads[NIDLE];
+  void *retval;
+  int i, n;
+
+  measure(0);
+
+  if(pipe(idle) < 0) {
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  for(n = 0; n < NIDLE; n++) {
+    if(thread_create(&threads[n], idlethread, 0) != 0) {
+      printf(1, "thread_create failed after %d lwps\n", n);
+      break;
+    }
+  }
+  sleep(10); // Let all of them block
+
+  measure(n);
+
+  close(idle[1]);
+  for(i = 0; i < n; i++)
+    thread_join(threads[i], &retval);
+  exit();
+}